@@ -0,0 +1,176 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Benchmark harness: start threads together, time each one
+ * Timing around a pthread_create/join loop counts thread creation and staggered
+ * starts as work: the first thread is half done before the last one exists.
+ * bench_run() instead creates and pins every thread (placement.h, $OSTEP_PLACE), lets each run its setup,
+ * then holds them on a spinning barrier and releases them at once. Each thread
+ * stamps its own start and end (timing.h cycles), so the report has the aggregate rate
+ * over the real parallel window plus per-thread rates, and flags imbalance.
+ *
+ *     bench_t b = { .nthreads = n, .worker = fn, .args = args, .arg_size = sizeof(args[0]),
+ *                   .ops_per_thread = OPS };
+ *     bench_run(&b);
+ *     bench_report(&b, "label");
+ *
+ * worker is an ordinary pthread start routine, called with &args[tid]. With
+ * ops_per_thread == 0 it returns its own op count as (void *)(long)ops.
+ */
+
+#ifndef __bench_h__
+#define __bench_h__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE    // pthread_attr_setaffinity_np; include this header before other system headers
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "locks.h"
+#include "placement.h"
+#include "timing.h"
+
+#define BENCH_MAX_THREADS 256
+#define BENCH_IMBALANCE_WARN 0.20    // Flag when the slowest thread's rate is 20% below the fastest
+
+typedef struct
+{
+    int tid;
+    int cpu;                // Pinned to, or -1
+    long ops;
+    uint64_t start_tsc;
+    uint64_t end_tsc;
+    struct bench *bench;
+} bench_thread_t;
+
+typedef struct bench
+{
+    // Set by the caller
+    int nthreads;
+    void *(*worker)(void *);
+    void *args;                  // Array of nthreads elements, arg_size bytes each
+    size_t arg_size;
+    long ops_per_thread;         // 0: worker returns its count
+    void (*setup)(void *arg);    // Optional, runs on the thread before the barrier
+    placement_t *placement;      // NULL: placement_default()
+    int no_pin;
+
+    // Results
+    double seconds;              // Release to last thread done
+    double ops_per_sec;
+    double imbalance;            // 1 - slowest / fastest per-thread rate
+    bench_thread_t threads[BENCH_MAX_THREADS];
+
+    atomic_int arrived;
+    atomic_int go;
+    uint64_t release_tsc;
+    double ns_per_tick;
+} bench_t;
+
+// Cycles from timing.h (calibrated TSC, else CLOCK_MONOTONIC ns)
+static inline uint64_t bench_ticks(void) {
+    return timing_cycles();
+}
+
+static inline double bench_now(void) {
+    return timing_now();
+}
+
+static void *bench_thread(void *arg) {
+    bench_thread_t *t = (bench_thread_t *)arg;
+    bench_t *b = t->bench;
+    void *warg = (char *)b->args + t->tid * b->arg_size;
+
+    if (b->setup != NULL)
+        b->setup(warg);
+    atomic_fetch_add(&b->arrived, 1);
+    int spins = 0;
+    while (!atomic_load_explicit(&b->go, memory_order_acquire))
+        lock_spin(&spins);
+
+    t->start_tsc = bench_ticks();
+    void *ret = b->worker(warg);
+    t->end_tsc = bench_ticks();
+    t->ops = b->ops_per_thread > 0 ? b->ops_per_thread : (long)ret;
+    return NULL;
+}
+
+static inline double bench_thread_ops_per_sec(bench_t *b, int tid) {
+    bench_thread_t *t = &b->threads[tid];
+    return t->ops / ((t->end_tsc - t->start_tsc) * b->ns_per_tick * 1e-9);
+}
+
+// Run the workers once; fills in the results half of b
+static inline void bench_run(bench_t *b) {
+    pthread_t threads[BENCH_MAX_THREADS];
+    placement_t *place = b->placement != NULL ? b->placement : placement_default();
+
+    assert(b->nthreads > 0 && b->nthreads <= BENCH_MAX_THREADS);
+    timing_init();    // Calibrate now, not in the first thread after the release
+    atomic_init(&b->arrived, 0);
+    atomic_init(&b->go, 0);
+
+    for (int i = 0; i < b->nthreads; i++) {
+        bench_thread_t *t = &b->threads[i];
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        t->tid = i;
+        t->bench = b;
+        t->cpu = b->no_pin ? -1 : placement_cpu(place, i);
+        if (t->cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(t->cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        pthread_create(&threads[i], &attr, bench_thread, t);
+        pthread_attr_destroy(&attr);
+    }
+
+    // Everyone created and set up: release them together
+    int spins = 0;
+    while (atomic_load(&b->arrived) < b->nthreads)
+        lock_spin(&spins);
+    b->release_tsc = bench_ticks();
+    atomic_store_explicit(&b->go, 1, memory_order_release);
+    for (int i = 0; i < b->nthreads; i++)
+        pthread_join(threads[i], NULL);
+    b->ns_per_tick = timing_init()->ns_per_cycle;
+
+    uint64_t first = UINT64_MAX, last = 0;
+    long total = 0;
+    double fastest = 0, slowest = 0;
+    for (int i = 0; i < b->nthreads; i++) {
+        bench_thread_t *t = &b->threads[i];
+        double rate = bench_thread_ops_per_sec(b, i);
+        first = t->start_tsc < first ? t->start_tsc : first;
+        last = t->end_tsc > last ? t->end_tsc : last;
+        total += t->ops;
+        fastest = i == 0 || rate > fastest ? rate : fastest;
+        slowest = i == 0 || rate < slowest ? rate : slowest;
+    }
+    b->seconds = (last - first) * b->ns_per_tick * 1e-9;
+    b->ops_per_sec = total / b->seconds;
+    b->imbalance = fastest > 0 ? 1.0 - slowest / fastest : 0;
+}
+
+// One summary line; per-thread lines too when the threads were out of balance
+static inline void bench_report(bench_t *b, const char *label) {
+    printf("  %s: %d threads, %.0f ops/second, imbalance %.0f%%%s\n", label, b->nthreads,
+           b->ops_per_sec, b->imbalance * 100, b->imbalance > BENCH_IMBALANCE_WARN ? "  <-- imbalanced" : "");
+    if (b->imbalance <= BENCH_IMBALANCE_WARN)
+        return;
+    for (int i = 0; i < b->nthreads; i++) {
+        bench_thread_t *t = &b->threads[i];
+        printf("    thread %d (cpu %d): %ld ops, %.0f ops/second, started %+.1f us after release, ran %.1f us\n",
+               i, t->cpu, t->ops, bench_thread_ops_per_sec(b, i),
+               (double)(int64_t)(t->start_tsc - b->release_tsc) * b->ns_per_tick / 1e3,
+               (t->end_tsc - t->start_tsc) * b->ns_per_tick / 1e3);
+    }
+}
+
+#endif // __bench_h__
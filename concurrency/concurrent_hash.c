@@ -3,16 +3,29 @@
  * 
  * Concurrent hash table with per-bucket locking
  * This is somewhat Redis/Memcached's basic (they have better hash func and dynamic scaling)
+ * Bucket lock comes from locks.h: gcc -DLOCK_IMPL=mcs ...
+ * or, with -DUSE_RWLOCK, a reader-writer lock from rwlock.h (lookups share it)
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <time.h>
+#include "trace.h"
+#include "rwlock.h"
+#include "bench.h"
 
 #define NUM_BUCKETS 101
 #define NUM_THREADS 4
 #define OPS_PER_THREAD 1000
+#define READ_MOSTLY_OPS 200000    // Per thread, in the read-mostly phase
+#define READ_PERCENT 95
+#define READ_MOSTLY_KEYS 4000
+
+// Trace events (OSTEP_TRACE=<file> to save them)
+enum { EV_WORKER, EV_INSERT, EV_LOOKUP, EV_DELETE };
+const char *const trace_names[] = { "worker", "insert", "lookup", "delete" };
 
 // Node for linked list in each bucket
 typedef struct node
@@ -26,7 +39,7 @@ typedef struct node
 typedef struct 
 {
     node_t *head;
-    pthread_mutex_t lock;
+    ds_lock_t lock;
 } bucket_t;
 
 // Hash table struc
@@ -42,7 +55,7 @@ void hash_init(hashtable_t *ht) {
 
     for (int i = 0; i < NUM_BUCKETS; i++) {
         ht->buckets[i].head = NULL;
-        pthread_mutex_init(&ht->buckets[i].lock, NULL);
+        ds_lock_init(&ht->buckets[i].lock);
     }
 
     printf("Hash table init with %d buckets\n", NUM_BUCKETS);
@@ -66,14 +79,14 @@ int hash_insert(hashtable_t *ht, int key, int value) {
     new_node->key = key;
     new_node->value = value;
 
-    pthread_mutex_lock(&bucket->lock);
+    ds_write_lock(&bucket->lock);
 
     // Check if key already exists
     node_t *cur = bucket->head;
     while (cur != NULL) {
         if (cur->key == key) {
             cur->value = value;
-            pthread_mutex_unlock(&bucket->lock);
+            ds_write_unlock(&bucket->lock);
             free(new_node);
             return 1;
         }
@@ -84,7 +97,7 @@ int hash_insert(hashtable_t *ht, int key, int value) {
     new_node->next = bucket->head;
     bucket->head = new_node;
 
-    pthread_mutex_unlock(&bucket->lock);
+    ds_write_unlock(&bucket->lock);
 
     return 0; // Inserted new
 }
@@ -94,18 +107,18 @@ int hash_lookup(hashtable_t *ht, int key, int *value) {
     int bucket_idx = hash_func(ht, key);
     bucket_t *bucket = &ht->buckets[bucket_idx];
 
-    pthread_mutex_lock(&bucket->lock);
+    int token = ds_read_lock(&bucket->lock);
 
     node_t *cur = bucket->head;
     while (cur != NULL) {
         if (cur->key == key) {
             *value = cur->value;
-            pthread_mutex_unlock(&bucket->lock);
+            ds_read_unlock(&bucket->lock, token);
             return 1;
         }
         cur = cur->next;
     }
-    pthread_mutex_unlock(&bucket->lock);
+    ds_read_unlock(&bucket->lock, token);
     return 0;
 }
 
@@ -114,7 +127,7 @@ int hash_delete(hashtable_t *ht, int key) {
     int bucket_idx = hash_func(ht, key);
     bucket_t *bucket = &ht->buckets[bucket_idx];
 
-    pthread_mutex_lock(&bucket->lock);
+    ds_write_lock(&bucket->lock);
 
     node_t *cur = bucket->head;
     node_t *prev = NULL;
@@ -126,7 +139,7 @@ int hash_delete(hashtable_t *ht, int key) {
             } else {
                 prev->next = cur->next;
             }
-            pthread_mutex_unlock(&bucket->lock);
+            ds_write_unlock(&bucket->lock);
             free(cur);
             return 1;
         }
@@ -134,14 +147,14 @@ int hash_delete(hashtable_t *ht, int key) {
         cur = cur->next;
     }
 
-    pthread_mutex_unlock(&bucket->lock);
+    ds_write_unlock(&bucket->lock);
     return 0;
 }
 
 // Cleanup hash table
 void hash_destroy(hashtable_t *ht) {
     for (int i = 0; i < NUM_BUCKETS; i++) {
-        pthread_mutex_lock(&ht->buckets[i].lock);
+        ds_write_lock(&ht->buckets[i].lock);
 
         node_t *cur = ht->buckets[i].head;
         while (cur != NULL) {
@@ -151,8 +164,8 @@ void hash_destroy(hashtable_t *ht) {
         }
         ht->buckets[i].head = NULL;
 
-        pthread_mutex_unlock(&ht->buckets[i].lock);
-        pthread_mutex_destroy(&ht->buckets[i].lock);
+        ds_write_unlock(&ht->buckets[i].lock);
+        ds_lock_destroy(&ht->buckets[i].lock);
     }
 }
 
@@ -161,7 +174,7 @@ void hash_stats(hashtable_t *ht) {
     int total = 0, max_chain = 0, non_empty_bucket = 0;
 
     for (int i = 0; i < NUM_BUCKETS; i++) {
-        pthread_mutex_lock(&ht->buckets[i].lock);
+        int token = ds_read_lock(&ht->buckets[i].lock);
 
         int chain_len = 0;
         node_t *cur = ht->buckets[i].head;
@@ -180,7 +193,7 @@ void hash_stats(hashtable_t *ht) {
             max_chain = chain_len;
         }
 
-        pthread_mutex_unlock(&ht->buckets[i].lock);
+        ds_read_unlock(&ht->buckets[i].lock, token);
     }
 
     printf("Total items: %d\n", total);
@@ -206,6 +219,8 @@ void* thread_worker(void* arg) {
     // Each thread works on a range of keys to reduce conflict
     int key_base = targ->thread_id * 1000;
 
+    trace_thread_init();    // Ring set up outside the measured loop
+    TRACE_BEGIN_EV(EV_WORKER, targ->thread_id);
     for (int i = 0; i < targ->num_ops; i++) {
         int key = key_base + (rand() % 500);
         int value = rand() % 1000;
@@ -213,18 +228,22 @@ void* thread_worker(void* arg) {
 
         if (op < 60) {
             hash_insert(targ->ht, key, value);
+            TRACE(EV_INSERT, targ->thread_id, key);
             success++;
         } else if (op < 90) {
             int found_value;
             if (hash_lookup(targ->ht, key, &found_value)) {
                 success++;
             }
+            TRACE(EV_LOOKUP, targ->thread_id, key);
         } else {
             if (hash_delete(targ->ht, key)) {
                 success++;
             }
+            TRACE(EV_DELETE, targ->thread_id, key);
         }
     }
+    TRACE_END_EV(EV_WORKER, targ->thread_id);
 
     *targ->ops_cnt = success;
     printf("Thread %d: Completed %d operations (%d successful)\n",
@@ -233,10 +252,55 @@ void* thread_worker(void* arg) {
     return NULL;
 }
 
-double get_time() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+// Read-mostly mix over one shared key range. rand_r: rand() takes a lock in glibc
+typedef struct
+{
+    hashtable_t *ht;
+    int thread_id;
+} rm_arg_t;
+
+void* read_mostly_worker(void* arg) {
+    rm_arg_t *rarg = (rm_arg_t *)arg;
+    unsigned seed = rarg->thread_id + 1;
+
+    trace_thread_init();
+    for (int i = 0; i < READ_MOSTLY_OPS; i++) {
+        int key = rand_r(&seed) % READ_MOSTLY_KEYS;
+        int op = rand_r(&seed) % 100;
+        int value;
+
+        if (op < READ_PERCENT) {
+            hash_lookup(rarg->ht, key, &value);
+        } else if (op & 1) {
+            hash_insert(rarg->ht, key, op);
+        } else {
+            hash_delete(rarg->ht, key);
+        }
+    }
+    return NULL;
+}
+
+// Take the trace ring before the start barrier
+void trace_setup(void* arg) {
+    (void)arg;
+    trace_thread_init();
+}
+
+// Same mix at 1, 2, 4, ... threads
+void run_read_mostly(hashtable_t *ht) {
+    printf("\nRead-mostly mix (%d%% lookups), %d ops per thread:\n", READ_PERCENT, READ_MOSTLY_OPS);
+    for (int n = 1; n <= NUM_THREADS; n *= 2) {
+        rm_arg_t args[NUM_THREADS];
+        for (int i = 0; i < n; i++) {
+            args[i].ht = ht;
+            args[i].thread_id = i;
+        }
+
+        bench_t b = { .nthreads = n, .worker = read_mostly_worker, .args = args, .arg_size = sizeof(args[0]),
+                      .ops_per_thread = READ_MOSTLY_OPS, .setup = trace_setup };
+        bench_run(&b);
+        bench_report(&b, "read-mostly");
+    }
 }
 
 void demonstrate_concurrency(hashtable_t *ht) {
@@ -253,39 +317,36 @@ void demonstrate_concurrency(hashtable_t *ht) {
 
 int main() {
     srand(time(NULL));
+    printf("Lock: %s (rebuild with -DLOCK_IMPL=... or -DUSE_RWLOCK)\n", DS_LOCK_NAME);
+    placement_print(placement_default(), stdout);
     
-    // Init hash table
+    // Init hash table on thread 0's node
     hashtable_t ht;
+    placement_pin_main();
     hash_init(&ht);
     
     // How different buckets can be accessed concurrently
     demonstrate_concurrency(&ht);
+    placement_unpin_main();
     
-    pthread_t threads[NUM_THREADS];
     thread_arg_t args[NUM_THREADS];
     int operation_counts[NUM_THREADS];
     
-    double start_time = get_time();
-    
-    // Create threads
     for (int i = 0; i < NUM_THREADS; i++) {
         args[i].ht = &ht;
         args[i].thread_id = i;
         args[i].num_ops = OPS_PER_THREAD;
         args[i].ops_cnt = &operation_counts[i];
-        pthread_create(&threads[i], NULL, thread_worker, &args[i]);
-    }
-    
-    for (int i = 0; i < NUM_THREADS; i++) {
-        pthread_join(threads[i], NULL);
     }
     
-    double end_time = get_time();
+    // Threads start together; each times itself
+    bench_t b = { .nthreads = NUM_THREADS, .worker = thread_worker, .args = args, .arg_size = sizeof(args[0]),
+                  .ops_per_thread = OPS_PER_THREAD, .setup = trace_setup };
+    bench_run(&b);
     
-    printf("Time: %.4f seconds\n", end_time - start_time);
+    printf("Time: %.4f seconds\n", b.seconds);
     printf("Total Ops: %d\n", NUM_THREADS * OPS_PER_THREAD);
-    printf("ops/second: %.0f\n", 
-           (NUM_THREADS * OPS_PER_THREAD) / (end_time - start_time));
+    bench_report(&b, "mixed");
     
     int total_successful = 0;
     for (int i = 0; i < NUM_THREADS; i++) {
@@ -306,6 +367,10 @@ int main() {
         }
     }
     
+    run_read_mostly(&ht);
+
+    trace_write_env(trace_names, sizeof(trace_names) / sizeof(trace_names[0]));
+
     // Clean up
     hash_destroy(&ht);
 
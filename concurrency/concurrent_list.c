@@ -2,16 +2,28 @@
  * OSTEP - Concurrency
  * 
  * Thread-safe linked list
+ * List lock comes from locks.h: gcc -DLOCK_IMPL=ticket ...
+ * or, with -DUSE_RWLOCK, a reader-writer lock from rwlock.h (lookups share it)
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <time.h>
+#include "trace.h"
+#include "rwlock.h"
+#include "bench.h"
 
 #define NUM_THREADS 4
 #define OPERATIONS_PER_THREAD 1000
 // #define OPERATIONS_PER_THREAD 100000
+#define READ_MOSTLY_OPS 10000    // Per thread, in the read-mostly phase
+#define READ_PERCENT 95
+
+// Trace events (OSTEP_TRACE=<file> to save them)
+enum { EV_WORKER, EV_LOOKUP_MISS };
+const char *const trace_names[] = { "worker", "lookup_miss" };
 
 // Node for linked list
 typedef struct node
@@ -24,12 +36,12 @@ typedef struct node
 typedef struct  
 {
     node_t *head;
-    pthread_mutex_t lock;
+    ds_lock_t lock;
 } list_t;
 
 void list_init(list_t *list) {
     list->head = NULL;
-    pthread_mutex_init(&list->lock, NULL);
+    ds_lock_init(&list->lock);
 }
 
 // Insert a key
@@ -44,10 +56,10 @@ int list_insert(list_t *list, int key) {
     new_node->key = key;
 
     // Only lock for the actual list update
-    pthread_mutex_lock(&list->lock);
+    ds_write_lock(&list->lock);
     new_node->next = list->head;  // Critical section
     list->head = new_node;        // Critical section
-    pthread_mutex_unlock(&list->lock);
+    ds_write_unlock(&list->lock);
 
     return 0;
 }
@@ -56,7 +68,7 @@ int list_insert(list_t *list, int key) {
 int list_lookup(list_t *list, int key) {
     int found = 0;
 
-    pthread_mutex_lock(&list->lock);
+    int token = ds_read_lock(&list->lock);
     node_t *cur = list->head;
     while (cur != NULL) {
         if (cur->key == key) {
@@ -65,7 +77,7 @@ int list_lookup(list_t *list, int key) {
         }
         cur = cur->next;
     }
-    pthread_mutex_unlock(&list->lock);
+    ds_read_unlock(&list->lock, token);
 
     return found;
 }
@@ -74,20 +86,20 @@ int list_lookup(list_t *list, int key) {
 int list_count(list_t *list) {
     int cnt = 0;
 
-    pthread_mutex_lock(&list->lock);
+    int token = ds_read_lock(&list->lock);
     node_t *cur = list->head;
     while (cur != NULL) {
         cnt++;
         cur = cur->next;
     }
-    pthread_mutex_unlock(&list->lock);
+    ds_read_unlock(&list->lock, token);
 
     return cnt;
 }
 
 // Cleanup list
 void list_destroy(list_t *list) {
-    pthread_mutex_lock(&list->lock);
+    ds_write_lock(&list->lock);
 
     node_t *cur = list->head;
     while (cur != NULL) {
@@ -97,13 +109,13 @@ void list_destroy(list_t *list) {
     }
     list->head = NULL;
 
-    pthread_mutex_unlock(&list->lock);
-    pthread_mutex_destroy(&list->lock);
+    ds_write_unlock(&list->lock);
+    ds_lock_destroy(&list->lock);
 }
 
 // Print list
 void list_print(list_t *list, int max_items) {
-    pthread_mutex_lock(&list->lock);
+    int token = ds_read_lock(&list->lock);
 
     printf("List contents (first %d items): ", max_items);
     node_t *cur = list->head;
@@ -118,7 +130,7 @@ void list_print(list_t *list, int max_items) {
     }
     printf("\n");
 
-    pthread_mutex_unlock(&list->lock);
+    ds_read_unlock(&list->lock, token);
 }
 
 // Thread arg structure
@@ -133,7 +145,10 @@ typedef struct
 void* thread_ops(void* arg) {
     thread_arg_t *targ = (thread_arg_t *)arg;
 
+    trace_thread_init();    // Ring set up outside the measured loop
+
     // Each thread inserts its own range of values
+    TRACE_BEGIN_EV(EV_WORKER, targ->thread_id);
     for (int i = 0; i < targ->num_ops; i++) {
         int val = targ->start_val + i;
         // int val = i;
@@ -142,50 +157,84 @@ void* thread_ops(void* arg) {
             if (i % 10 == 0) {
                 int found = list_lookup(targ->list, val);
                 if (!found) {
+                    TRACE(EV_LOOKUP_MISS, targ->thread_id, val);
                     printf("Thread %d: ERROR - just inserted %d but can't find it\n", targ->thread_id, val);
                 }
             }
         }
     }
+    TRACE_END_EV(EV_WORKER, targ->thread_id);
     printf("Thread %d: Completed %d insertions\n", targ->thread_id, targ->num_ops);
     return NULL;
 }
 
-double get_time() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+// Read-mostly mix: lookups of existing keys, the rest inserts
+void* read_mostly_ops(void* arg) {
+    thread_arg_t *targ = (thread_arg_t *)arg;
+    unsigned seed = targ->thread_id + 1;    // rand_r: rand() takes a lock in glibc
+
+    trace_thread_init();
+    for (int i = 0; i < targ->num_ops; i++) {
+        if (rand_r(&seed) % 100 < READ_PERCENT) {
+            list_lookup(targ->list, rand_r(&seed) % targ->start_val);
+        } else {
+            list_insert(targ->list, targ->start_val + i);
+        }
+    }
+    return NULL;
+}
+
+// Take the trace ring before the start barrier
+void trace_setup(void* arg) {
+    (void)arg;
+    trace_thread_init();
+}
+
+// Same mix at 1, 2, 4, ... threads
+void run_read_mostly(list_t *list, int num_keys) {
+    printf("\nRead-mostly mix (%d%% lookups), %d ops per thread:\n", READ_PERCENT, READ_MOSTLY_OPS);
+    for (int n = 1; n <= NUM_THREADS; n *= 2) {
+        thread_arg_t args[NUM_THREADS];
+        for (int i = 0; i < n; i++) {
+            args[i].list = list;
+            args[i].thread_id = i;
+            args[i].start_val = num_keys;
+            args[i].num_ops = READ_MOSTLY_OPS;
+        }
+
+        bench_t b = { .nthreads = n, .worker = read_mostly_ops, .args = args, .arg_size = sizeof(args[0]),
+                      .ops_per_thread = READ_MOSTLY_OPS, .setup = trace_setup };
+        bench_run(&b);
+        bench_report(&b, "read-mostly");
+    }
 }
 
 int main() {
-    // Init the list
+    printf("Lock: %s (rebuild with -DLOCK_IMPL=... or -DUSE_RWLOCK)\n", DS_LOCK_NAME);
+    placement_print(placement_default(), stdout);
+
+    // Init the list on thread 0's node (nodes are allocated by the inserting threads)
     list_t list;
+    placement_pin_main();
     list_init(&list);
+    placement_unpin_main();
 
     // Create thread args
-    pthread_t threads[NUM_THREADS];
     thread_arg_t args[NUM_THREADS];
-
-    printf("Starting concurrent insertions...\n");
-    double start_time = get_time();
-
-    // Create threads
     for (int i = 0; i < NUM_THREADS; i++) {
         args[i].list = &list;
         args[i].thread_id = i;
         args[i].start_val = i * OPERATIONS_PER_THREAD; // Non-overlapping ranges
         args[i].num_ops = OPERATIONS_PER_THREAD;
-        pthread_create(&threads[i], NULL, thread_ops, &args[i]);
     }
 
-    for (int i = 0; i < NUM_THREADS; i++) {
-        pthread_join(threads[i], NULL);
-    }
-
-    double end_time = get_time();
+    printf("Starting concurrent insertions...\n");
+    bench_t b = { .nthreads = NUM_THREADS, .worker = thread_ops, .args = args, .arg_size = sizeof(args[0]),
+                  .ops_per_thread = OPERATIONS_PER_THREAD, .setup = trace_setup };
+    bench_run(&b);
 
-    
-    printf("Time taken: %.4f seconds\n", end_time - start_time);
+    printf("Time taken: %.4f seconds\n", b.seconds);
+    bench_report(&b, "insert");
     
     int total_count = list_count(&list);
     printf("Total elements in list: %d\n", total_count);
@@ -208,6 +257,10 @@ int main() {
                test_values[i], found ? "FOUND" : "NOT FOUND");
     }
     
+    run_read_mostly(&list, NUM_THREADS * OPERATIONS_PER_THREAD);
+
+    trace_write_env(trace_names, sizeof(trace_names) / sizeof(trace_names[0]));
+
     // Clean up
     list_destroy(&list);
 
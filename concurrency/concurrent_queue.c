@@ -2,22 +2,47 @@
  * OSTEP - Concurrency
  * 
  * Michael & Scott style concurrent queue with separate head/tail lock
+ * ./concurrent_queue fc [threads] compares it with a flat-combining queue (flat_combining.h)
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <pthread.h>
 #include <time.h>
 #include <unistd.h>
+#include "msg_queue.h"
+#include "histogram.h"
+#include "trace.h"
+#include "locks.h"
+#include "flat_combining.h"
+#include "bench.h"
+#include "timing.h"
 
 #define NUM_PRODUCERS 2
 #define NUM_CONSUMERS 2
 #define ITEMS_PER_PRODUCER 1000
 
+// Message mode (./concurrent_queue msg)
+#define MSGS_PER_PRODUCER 200000
+#define MSG_MIN_BYTES 32      // Must hold msg_t
+#define MSG_MAX_BYTES 1024
+
+// Flat-combining comparison (./concurrent_queue fc)
+#define FC_PAIRS_PER_THREAD 100000    // enqueue + dequeue pairs
+#define FC_DEFAULT_THREADS 16
+
+// Trace events (OSTEP_TRACE=<file> to save them)
+enum { EV_ENQUEUE, EV_DEQUEUE, EV_EMPTY };
+const char *const trace_names[] = { "enqueue", "dequeue", "empty" };
+
 // Node structure for queue
 typedef struct node
 {
     int value;
+    uint64_t enq_ns;   // Timestamp taken at enqueue, for sojourn latency
     struct node *next;
 } node_t;
 
@@ -26,8 +51,8 @@ typedef struct
 {
     node_t *head;  // For dequeue
     node_t *tail;  // For enqueue
-    pthread_mutex_t head_lock;
-    pthread_mutex_t tail_lock;
+    lock_t head_lock;
+    lock_t tail_lock;
 } queue_t;
 
 // Init queue with dummy node
@@ -39,8 +64,8 @@ void queue_init(queue_t *q) {
     q->head = dummy;
     q->tail = dummy;
 
-    pthread_mutex_init(&q->head_lock, NULL);
-    pthread_mutex_init(&q->tail_lock, NULL);
+    lock_init(&q->head_lock);
+    lock_init(&q->tail_lock);
 
     printf("Queue init with dummy node at %p\n", (void *)dummy);
 }
@@ -51,34 +76,38 @@ void q_enqueue(queue_t *q, int value) {
     node_t *new_node = (node_t *)malloc(sizeof(node_t));
     new_node->value = value;
     new_node->next = NULL;
+    new_node->enq_ns = timing_ns();
     
     // Only lock tail
-    pthread_mutex_lock(&q->tail_lock);
+    lock_acquire(&q->tail_lock);
 
     // Add to tail
     q->tail->next = new_node;
     q->tail = new_node;
 
-    pthread_mutex_unlock(&q->tail_lock);
+    lock_release(&q->tail_lock);
 }
 
 // Dequeue (remove from head)
-int q_dequeue(queue_t *q, int *value) {
+// enq_ns (optional) gets the timestamp the item was enqueued with
+int q_dequeue(queue_t *q, int *value, uint64_t *enq_ns) {
     // Only lock head for dequeue
-    pthread_mutex_lock(&q->head_lock);
+    lock_acquire(&q->head_lock);
 
     node_t *dummy = q->head;
     node_t *new_head = dummy->next;
 
     if (new_head == NULL) {
-        pthread_mutex_unlock(&q->head_lock);
+        lock_release(&q->head_lock);
         return -1;
     }
 
     *value = new_head->value;
+    if (enq_ns != NULL)
+        *enq_ns = new_head->enq_ns;
     q->head = new_head;
 
-    pthread_mutex_unlock(&q->head_lock);
+    lock_release(&q->head_lock);
 
     free(dummy);
 
@@ -87,16 +116,16 @@ int q_dequeue(queue_t *q, int *value) {
 
 // Check if queue is empty
 int q_is_empty(queue_t *q) {
-    pthread_mutex_lock(&q->head_lock);
+    lock_acquire(&q->head_lock);
     int empty = (q->head->next == NULL);
-    pthread_mutex_unlock(&q->head_lock);
+    lock_release(&q->head_lock);
     return empty;
 }
 
 // Get queue size (we need to lock both)
 int q_size(queue_t *q) {
-    pthread_mutex_lock(&q->head_lock);
-    pthread_mutex_lock(&q->tail_lock);
+    lock_acquire(&q->head_lock);
+    lock_acquire(&q->tail_lock);
 
     int cnt = 0;
     node_t *cur = q->head->next;
@@ -105,8 +134,8 @@ int q_size(queue_t *q) {
         cur = cur->next;
     }
 
-    pthread_mutex_unlock(&q->head_lock);
-    pthread_mutex_unlock(&q->tail_lock);
+    lock_release(&q->head_lock);
+    lock_release(&q->tail_lock);
 
     return cnt;
 }
@@ -114,13 +143,13 @@ int q_size(queue_t *q) {
 // Cleanup queue
 void q_destroy(queue_t *q) {
     int val;
-    while (q_dequeue(q, &val) == 0) {
+    while (q_dequeue(q, &val, NULL) == 0) {
     }
 
     free(q->head);
 
-    pthread_mutex_destroy(&q->head_lock);
-    pthread_mutex_destroy(&q->tail_lock);
+    lock_destroy(&q->head_lock);
+    lock_destroy(&q->tail_lock);
 }
 
 // Producer/Consumer thread args
@@ -136,10 +165,13 @@ typedef struct
     queue_t *queue;
     int con_id;
     int *con_cnt;
+    histogram_t hist;   // Per-consumer sojourn times (ns), merged in main
 } con_arg_t;
 
 void* prod_thread(void* arg) {
     prod_arg_t *parg = (prod_arg_t *)arg;
+    placement_pin_self(placement_default(), NUM_CONSUMERS + parg->prod_id);    // Consumers come first
+    trace_thread_init();
 
     printf("Producer %d: Starting to produce %d items\n",
            parg->prod_id, parg->num_items);
@@ -148,12 +180,7 @@ void* prod_thread(void* arg) {
         // Generate unique val for each producer
         int val = parg->prod_id * 10000 + i;
         q_enqueue(parg->queue, val);
-
-        // Print progress
-        if ((i + 1) % 250 == 0) {
-            printf("Producer %d: Produced %d items\n",
-                   parg->prod_id, i + 1);
-        }
+        TRACE(EV_ENQUEUE, parg->prod_id, val);
 
         // Simulate small delay
         if (i % 100 == 0) {
@@ -170,18 +197,19 @@ void* con_thread(void* arg) {
     con_arg_t *carg = (con_arg_t *)arg;
     int local_cnt = 0;
     int val;
+    placement_pin_self(placement_default(), carg->con_id);
+    trace_thread_init();
 
     printf("Consumer %d: Starting consumption\n", carg->con_id);
 
     while (1) {
-        if (q_dequeue(carg->queue, &val) == 0) {
+        uint64_t enq_ns;
+        if (q_dequeue(carg->queue, &val, &enq_ns) == 0) {
+            hist_record(&carg->hist, timing_ns() - enq_ns);
             local_cnt++;
-
-            if (local_cnt % 250 == 0) {
-                printf("Consumer %d: Consumed %d items (latest: %d)\n",
-                       carg->con_id, local_cnt, val);
-            }
+            TRACE(EV_DEQUEUE, carg->con_id, val);
         } else {
+            TRACE(EV_EMPTY, carg->con_id, local_cnt);
             // Queue is empty - check if we should exit
             // In real case, we'd use condition var here
             usleep(1000);
@@ -205,20 +233,293 @@ void* con_thread(void* arg) {
     return NULL;
 }
 
-double get_time() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+// Message mode: variable-size payloads written and read in place
+typedef struct
+{
+    int producer;
+    int seq;
+    uint32_t sum;   // Checksum of the bytes that follow
+    uint64_t enq_ns;
+} msg_t;
+
+typedef struct
+{
+    msg_queue_t *queue;
+    int id;
+    atomic_int *producers_left;
+    long msgs;
+    long bytes;
+    long bad;
+    histogram_t hist;
+} msg_arg_t;
+
+void* msg_prod_thread(void* arg) {
+    msg_arg_t *marg = (msg_arg_t *)arg;
+    placement_pin_self(placement_default(), NUM_CONSUMERS + marg->id);
+    uint32_t rng = marg->id * 2654435761u + 1;
+
+    for (int i = 0; i < MSGS_PER_PRODUCER; i++) {
+        rng = rng * 1103515245 + 12345;
+        uint32_t len = MSG_MIN_BYTES + (rng >> 8) % (MSG_MAX_BYTES - MSG_MIN_BYTES + 1);
+
+        msg_t *m;
+        while ((m = msgq_reserve(marg->queue, len)) == NULL) {
+            sched_yield();   // Every segment in use, let consumers catch up
+        }
+
+        // Build the message directly in the queue's memory
+        m->producer = marg->id;
+        m->seq = i;
+        m->sum = 0;
+        uint8_t *body = (uint8_t *)(m + 1);
+        for (uint32_t j = 0; j < len - sizeof(msg_t); j++) {
+            body[j] = (uint8_t)(i + j);
+            m->sum += body[j];
+        }
+        m->enq_ns = timing_ns();
+        msgq_commit(marg->queue, m);
+
+        marg->msgs++;
+        marg->bytes += len;
+    }
+
+    atomic_fetch_sub(marg->producers_left, 1);
+    return NULL;
+}
+
+void* msg_con_thread(void* arg) {
+    msg_arg_t *marg = (msg_arg_t *)arg;
+    placement_pin_self(placement_default(), marg->id);
+
+    while (1) {
+        // Check the flag before reading, so an empty read after it means really done
+        int done = atomic_load(marg->producers_left) == 0;
+        uint32_t len;
+        msg_t *m = msgq_read(marg->queue, &len);
+        if (m == NULL) {
+            if (done)
+                break;
+            sched_yield();
+            continue;
+        }
+
+        // Verify in place, no copy out
+        uint32_t sum = 0;
+        uint8_t *body = (uint8_t *)(m + 1);
+        for (uint32_t j = 0; j < len - sizeof(msg_t); j++) {
+            sum += body[j];
+        }
+        if (sum != m->sum)
+            marg->bad++;
+        hist_record(&marg->hist, timing_ns() - m->enq_ns);
+        msgq_release(marg->queue, m);
+
+        marg->msgs++;
+        marg->bytes += len;
+    }
+    return NULL;
+}
+
+// Merge per-consumer histograms, print percentiles, optionally dump CSV
+void report_latency(histogram_t *hists[], int n, const char *csv_path, const char *label) {
+    histogram_t total;
+    hist_init(&total);
+    for (int i = 0; i < n; i++) {
+        hist_merge(&total, hists[i]);
+    }
+    hist_print(&total, "Enqueue-to-dequeue latency", "ns");
+
+    if (csv_path != NULL) {
+        FILE *out = fopen(csv_path, "w");
+        if (out == NULL) {
+            perror(csv_path);
+            return;
+        }
+        fprintf(out, "mode,latency_ns,count,cumulative\n");
+        hist_dump_csv(&total, out, label);
+        fclose(out);
+        printf("Latency histogram written to %s\n", csv_path);
+    }
 }
 
-int main() {
+int run_msg_mode(const char *csv_path) {
+    printf("Message mode: %d producers, %d consumers, %d msgs each, %d-%d bytes\n",
+           NUM_PRODUCERS, NUM_CONSUMERS, MSGS_PER_PRODUCER, MSG_MIN_BYTES, MSG_MAX_BYTES);
+    printf("Buffer: %d segments x %d KB\n\n", MSGQ_NUM_SEGS, MSGQ_SEG_SIZE / 1024);
+
+    msg_queue_t queue;
+    placement_pin_main();
+    msgq_init(&queue);
+    placement_unpin_main();
+    atomic_int producers_left = NUM_PRODUCERS;
+
+    pthread_t producers[NUM_PRODUCERS];
+    pthread_t consumers[NUM_CONSUMERS];
+    msg_arg_t prod_args[NUM_PRODUCERS];
+    msg_arg_t cons_args[NUM_CONSUMERS];
+
+    double start_time = timing_now();
+
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        cons_args[i] = (msg_arg_t){ .queue = &queue, .id = i, .producers_left = &producers_left };
+        hist_init(&cons_args[i].hist);
+        pthread_create(&consumers[i], NULL, msg_con_thread, &cons_args[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        prod_args[i] = (msg_arg_t){ .queue = &queue, .id = i, .producers_left = &producers_left };
+        pthread_create(&producers[i], NULL, msg_prod_thread, &prod_args[i]);
+    }
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        pthread_join(consumers[i], NULL);
+    }
+
+    double end_time = timing_now();
+
+    long sent = 0, sent_bytes = 0, received = 0, received_bytes = 0, bad = 0;
+    for (int i = 0; i < NUM_PRODUCERS; i++) {
+        sent += prod_args[i].msgs;
+        sent_bytes += prod_args[i].bytes;
+    }
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        printf("Consumer %d consumed: %ld msgs\n", i, cons_args[i].msgs);
+        received += cons_args[i].msgs;
+        received_bytes += cons_args[i].bytes;
+        bad += cons_args[i].bad;
+    }
+
+    printf("\nTime: %.3f seconds\n", end_time - start_time);
+    printf("Sent: %ld msgs (%ld bytes), received: %ld msgs (%ld bytes)\n",
+           sent, sent_bytes, received, received_bytes);
+    printf("Throughput: %.0f msgs/sec, %.1f MB/sec\n",
+           received / (end_time - start_time), received_bytes / (end_time - start_time) / 1e6);
+
+    if (received == sent && bad == 0) {
+        printf("Success: All messages received intact!\n");
+    } else {
+        printf("Warning: %ld missing, %ld corrupted\n", sent - received, bad);
+    }
+
+    histogram_t *hists[NUM_CONSUMERS];
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        hists[i] = &cons_args[i].hist;
+    }
+    report_latency(hists, NUM_CONSUMERS, csv_path, "msg");
+
+    msgq_destroy(&queue);
+    return 0;
+}
+
+// Flat-combining mode: every thread alternates enqueue and dequeue on one queue
+typedef struct
+{
+    queue_t *lock_q;
+    fc_queue_t *fc_q;
+    int tid;
+} pair_arg_t;
+
+void* lock_pair_thread(void* arg) {
+    pair_arg_t *parg = (pair_arg_t *)arg;
+    int val;
+    for (int i = 0; i < FC_PAIRS_PER_THREAD; i++) {
+        q_enqueue(parg->lock_q, i);
+        q_dequeue(parg->lock_q, &val, NULL);
+    }
+    return NULL;
+}
+
+void* fc_pair_thread(void* arg) {
+    pair_arg_t *parg = (pair_arg_t *)arg;
+    for (int i = 0; i < FC_PAIRS_PER_THREAD; i++) {
+        // Allocate and free outside the combiner, like q_enqueue/q_dequeue do
+        fc_qnode_t *n = malloc(sizeof(fc_qnode_t));
+        n->value = i;
+        fc_queue_enqueue(parg->fc_q, parg->tid, n);
+        free(fc_queue_dequeue(parg->fc_q, parg->tid));
+    }
+    return NULL;
+}
+
+// Aggregate ops/second over the window where all threads ran; *imbalance from bench.h
+double run_pairs(void *(*fn)(void *), queue_t *lock_q, fc_queue_t *fc_q, int nthreads, double *imbalance) {
+    pair_arg_t args[FC_MAX_THREADS];
+    for (int i = 0; i < nthreads; i++) {
+        args[i].lock_q = lock_q;
+        args[i].fc_q = fc_q;
+        args[i].tid = i;
+    }
+
+    bench_t b = { .nthreads = nthreads, .worker = fn, .args = args, .arg_size = sizeof(args[0]),
+                  .ops_per_thread = 2 * FC_PAIRS_PER_THREAD };
+    bench_run(&b);
+    *imbalance = b.imbalance;
+    return b.ops_per_sec;
+}
+
+int run_fc_mode(int max_threads) {
+    // Each run leaves both queues empty (every dequeue follows an enqueue), so reuse them
+    queue_t lock_q;
+    fc_queue_t fc_q;
+    placement_pin_main();
+    queue_init(&lock_q);
+    fc_queue_init(&fc_q);
+    placement_unpin_main();
+
+    printf("Two-lock queue (%s) vs flat-combining queue, %d enqueue/dequeue pairs per thread\n",
+           LOCK_NAME, FC_PAIRS_PER_THREAD);
+    printf("%8s %16s %16s %14s %10s\n", "threads", "two_lock ops/s", "fc ops/s", "two_lock imb", "fc imb");
+
+    for (int n = 1; n <= max_threads; n = n < max_threads && n * 2 > max_threads ? max_threads : n * 2) {
+        double lock_imb, fc_imb;
+        double lock_ops = run_pairs(lock_pair_thread, &lock_q, NULL, n, &lock_imb);
+        double fc_ops = run_pairs(fc_pair_thread, NULL, &fc_q, n, &fc_imb);
+        printf("%8d %16.0f %16.0f %13.0f%% %9.0f%%\n", n, lock_ops, fc_ops, lock_imb * 100, fc_imb * 100);
+    }
+
+    q_destroy(&lock_q);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    // usage: concurrent_queue [msg | fc [threads]] [--csv <file>]
+    int msg_mode = 0, fc_mode = 0, fc_threads = FC_DEFAULT_THREADS;
+    const char *csv_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "msg") == 0) {
+            msg_mode = 1;
+        } else if (strcmp(argv[i], "fc") == 0) {
+            fc_mode = 1;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                fc_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) {
+            csv_path = argv[++i];
+        } else {
+            fprintf(stderr, "usage: concurrent_queue [msg | fc [threads]] [--csv <file>]\n");
+            exit(1);
+        }
+    }
+    placement_print(placement_default(), stdout);
+    if (msg_mode) {
+        return run_msg_mode(csv_path);
+    }
+    if (fc_mode) {
+        if (fc_threads > FC_MAX_THREADS)
+            fc_threads = FC_MAX_THREADS;
+        return run_fc_mode(fc_threads);
+    }
+
+    printf("Lock: %s (rebuild with -DLOCK_IMPL=...)\n", LOCK_NAME);
     printf("Producers: %d, Consumers: %d\n", NUM_PRODUCERS, NUM_CONSUMERS);
     printf("Items per producer: %d\n", ITEMS_PER_PRODUCER);
     printf("Total items: %d\n\n", NUM_PRODUCERS * ITEMS_PER_PRODUCER);
     
     // Init queue
     queue_t queue;
+    placement_pin_main();
     queue_init(&queue);
+    placement_unpin_main();
     
     // Create producer and consumer threads
     pthread_t producers[NUM_PRODUCERS];
@@ -227,7 +528,7 @@ int main() {
     con_arg_t cons_args[NUM_CONSUMERS];
     int consumed_counts[NUM_CONSUMERS];
     
-    double start_time = get_time();
+    double start_time = timing_now();
     
     // Start consumers first
     printf("Starting consumers...\n");
@@ -235,6 +536,7 @@ int main() {
         cons_args[i].queue = &queue;
         cons_args[i].con_id = i;
         cons_args[i].con_cnt = &consumed_counts[i];
+        hist_init(&cons_args[i].hist);
         pthread_create(&consumers[i], NULL, con_thread, &cons_args[i]);
     }
     
@@ -265,7 +567,7 @@ int main() {
         pthread_join(consumers[i], NULL);
     }
     
-    double end_time = get_time();
+    double end_time = timing_now();
     
     printf("Time: %.3f seconds\n", end_time - start_time);
     
@@ -284,6 +586,14 @@ int main() {
         printf("Warning: Not all items consumed\n");
         printf("Items remaining in queue: %d\n", q_size(&queue));
     }
+
+    // Histograms live in cons_args, so they survive the pthread_cancel above
+    histogram_t *hists[NUM_CONSUMERS];
+    for (int i = 0; i < NUM_CONSUMERS; i++) {
+        hists[i] = &cons_args[i].hist;
+    }
+    report_latency(hists, NUM_CONSUMERS, csv_path, "int");
+    trace_write_env(trace_names, sizeof(trace_names) / sizeof(trace_names[0]));
     
     // Clean up
     q_destroy(&queue);
@@ -1,38 +1,95 @@
 /**
  * OSTEP - Concurrency
- * 
- * The difference between unsafe/safe counters
+ *
+ * Counter scalability matrix
+ * unsafe, mutex, spinlock, atomic fetch_add, sloppy (several S), per-thread padded
+ * and flat-combining counters, each run at 1..N threads. par_reduce counts the same
+ * total with parallel_reduce (thread-api/parallel.h) on a pool of N workers.
+ * The lock_<impl> row uses the lock picked from locks.h: gcc -DLOCK_IMPL=clh ...
+ * Every cell gets one warmup run, then REPEATS timed runs (median reported).
+ *
+ * usage: counter_comparison [--csv|--json] [max_threads]
+ * Threads are pinned per $OSTEP_PLACE (placement.h); the choice goes to stderr.
+ * ns_per_op is the time one thread spends per increment: elapsed * threads / total ops.
+ * Threads start together (bench.h); imbalance is the worst 1 - slowest/fastest thread rate
+ * over the timed runs. par_reduce claims chunks dynamically and has no per-thread rates:
+ * it leaves imbalance empty (null in JSON) and reports chunk_spread instead, the worst
+ * 1 - fewest/most chunks per worker. Its pool threads are not pinned.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <time.h>
+#include <unistd.h>
+#include "locks.h"
+#include "flat_combining.h"
+#include "bench.h"
+#include "../thread-api/parallel.h"
 
-#define NUM_THREADS 4
 #define INCREMENTS_PER_THREAD 1000000
+#define REPEATS 5
+#define MAX_THREADS 256
+#define CACHE_LINE_SIZE 64
 
-// Unsafe
+// Unsafe (volatile so the compiler can't fold the loop into one add)
 typedef struct
 {
-    int value;
+    volatile int value;
 } unsafe_counter_t;
 
 // Thread-safe counter (with mutex)
-typedef struct 
+typedef struct
 {
     int value;
     pthread_mutex_t lock;
-}safe_counter_t;
+} safe_counter_t;
 
-// Global counter for testing
-unsafe_counter_t unsafe_counter = {0};
-safe_counter_t safe_counter;
+typedef struct
+{
+    long value;
+    pthread_spinlock_t lock;
+} spin_counter_t;
 
-void safe_counter_init(safe_counter_t *c) {
-    c->value = 0;
-    pthread_mutex_init(&c->lock, NULL);
-}
+// Counter behind whichever lock locks.h was built with
+typedef struct
+{
+    long value;
+    lock_t lock;
+} lib_counter_t;
+
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) long value;
+} padded_long_t;
+
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) atomic_long value;
+} padded_atomic_t;
+
+// Sloppy counter, per-CPU design from sloppy_counter.c
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) atomic_long global;
+    padded_atomic_t *local;
+    int num_cpus;
+    int threshold;
+} sloppy_counter_t;
+
+// Global counters for testing
+unsafe_counter_t unsafe_counter;
+safe_counter_t safe_counter;
+spin_counter_t spin_counter;
+lib_counter_t lib_counter;
+padded_atomic_t atomic_counter;
+sloppy_counter_t sloppy_counter;
+padded_long_t per_thread[MAX_THREADS];
+fc_counter_t fc_counter;    // flat_combining.h
 
 // Thread func for unsafe_counter
 void* unsafe_increment(void* arg) {
@@ -52,55 +109,316 @@ void* safe_increment(void* arg) {
     return NULL;
 }
 
-// Get the time
-double get_time() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+void* spin_increment(void* arg) {
+    (void)arg;
+    for (int i = 0; i < INCREMENTS_PER_THREAD; i++) {
+        pthread_spin_lock(&spin_counter.lock);
+        spin_counter.value++;
+        pthread_spin_unlock(&spin_counter.lock);
+    }
+    return NULL;
 }
 
-int main() {
-    pthread_t threads[NUM_THREADS];
-    double start_time, end_time;
+void* lock_increment(void* arg) {
+    (void)arg;
+    for (int i = 0; i < INCREMENTS_PER_THREAD; i++) {
+        lock_acquire(&lib_counter.lock);
+        lib_counter.value++;
+        lock_release(&lib_counter.lock);
+    }
+    return NULL;
+}
 
-    // Test unsafe counter (will likely get the wrong result)
-    printf("Test Unsafe counter\n");
+void* atomic_increment(void* arg) {
+    (void)arg;
+    for (int i = 0; i < INCREMENTS_PER_THREAD; i++) {
+        atomic_fetch_add_explicit(&atomic_counter.value, 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+void* sloppy_increment(void* arg) {
+    (void)arg;
+    sloppy_counter_t *c = &sloppy_counter;
+    for (int i = 0; i < INCREMENTS_PER_THREAD; i++) {
+        int cpu = sched_getcpu();
+        padded_atomic_t *slot = &c->local[cpu >= 0 && cpu < c->num_cpus ? cpu : 0];
+        if (atomic_fetch_add_explicit(&slot->value, 1, memory_order_relaxed) + 1 >= c->threshold) {
+            long moved = atomic_exchange_explicit(&slot->value, 0, memory_order_relaxed);
+            atomic_fetch_add_explicit(&c->global, moved, memory_order_relaxed);
+        }
+    }
+    return NULL;
+}
+
+// Each thread owns one padded slot: no sharing at all, sum at the end
+void* per_thread_increment(void* arg) {
+    padded_long_t *mine = &per_thread[(long)arg];
+    for (int i = 0; i < INCREMENTS_PER_THREAD; i++) {
+        // Keep the store in the loop, like a real counter would
+        __atomic_store_n(&mine->value, mine->value + 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+void* fc_increment(void* arg) {
+    int tid = (int)(long)arg;
+    for (int i = 0; i < INCREMENTS_PER_THREAD; i++) {
+        fc_counter_add(&fc_counter, tid, 1);
+    }
+    return NULL;
+}
+
+// parallel_reduce: each chunk counts into a local, one combine per worker at the end
+long count_chunk(long lo, long hi, void *arg) {
+    (void)arg;
+    long local = 0;
+    for (long i = lo; i < hi; i++) {
+        // Same store per increment as per_thread, but to this task's stack
+        __atomic_store_n(&local, local + 1, __ATOMIC_RELAXED);
+    }
+    return local;
+}
+
+long add_long(long a, long b) {
+    return a + b;
+}
+
+// One row of the matrix (worker NULL: parallel_reduce, timed by run_reduce)
+typedef struct
+{
+    const char *name;
+    int param;    // Threshold S for sloppy, unused otherwise
+    void *(*worker)(void *);
+} counter_impl_t;
+
+counter_impl_t impls[] = {
+    { "unsafe",     0,    unsafe_increment },
+    { "mutex",      0,    safe_increment },
+    { "spinlock",   0,    spin_increment },
+    { "lock_" LOCK_NAME, 0, lock_increment },
+    { "atomic",     0,    atomic_increment },
+    { "sloppy",     16,   sloppy_increment },
+    { "sloppy",     256,  sloppy_increment },
+    { "sloppy",     4096, sloppy_increment },
+    { "per_thread", 0,    per_thread_increment },
+    { "flat_comb",  0,    fc_increment },
+    { "par_reduce", 0,    NULL },
+};
+
+void counter_reset(counter_impl_t *impl) {
     unsafe_counter.value = 0;
+    safe_counter.value = 0;
+    spin_counter.value = 0;
+    lib_counter.value = 0;
+    atomic_store(&atomic_counter.value, 0);
+
+    atomic_store(&sloppy_counter.global, 0);
+    for (int i = 0; i < sloppy_counter.num_cpus; i++) {
+        atomic_store(&sloppy_counter.local[i].value, 0);
+    }
+    sloppy_counter.threshold = impl->param;
+
+    for (int i = 0; i < MAX_THREADS; i++) {
+        per_thread[i].value = 0;
+    }
+    fc_counter_init(&fc_counter);
+}
+
+long counter_value(counter_impl_t *impl) {
+    if (impl->worker == unsafe_increment)
+        return unsafe_counter.value;
+    if (impl->worker == safe_increment)
+        return safe_counter.value;
+    if (impl->worker == spin_increment)
+        return spin_counter.value;
+    if (impl->worker == lock_increment)
+        return lib_counter.value;
+    if (impl->worker == atomic_increment)
+        return atomic_load(&atomic_counter.value);
+    if (impl->worker == fc_increment)
+        return fc_counter.value;
+
+    long total = 0;
+    if (impl->worker == sloppy_increment) {
+        total = atomic_load(&sloppy_counter.global);
+        for (int i = 0; i < sloppy_counter.num_cpus; i++)
+            total += atomic_load(&sloppy_counter.local[i].value);
+    } else {
+        for (int i = 0; i < MAX_THREADS; i++)
+            total += per_thread[i].value;
+    }
+    return total;
+}
 
-    start_time = get_time();
-    for (int i = 0; i < NUM_THREADS; i++) {
-        pthread_create(&threads[i], NULL, unsafe_increment, NULL);
+// The workers take their thread id as the argument itself
+typedef struct
+{
+    counter_impl_t *impl;
+    long tid;
+} run_arg_t;
+
+void* run_worker(void* arg) {
+    run_arg_t *rarg = (run_arg_t *)arg;
+    return rarg->impl->worker((void *)rarg->tid);
+}
+
+double run_reduce(int nthreads, long *lost, double *spread) {
+    thread_pool_t pool;
+    long chunks[POOL_MAX_WORKERS];
+    long total = (long)nthreads * INCREMENTS_PER_THREAD;
+    int workers = nthreads < POOL_MAX_WORKERS ? nthreads : POOL_MAX_WORKERS;
+
+    pool_init(&pool, workers);
+    double start = bench_now();
+    long count = parallel_reduce_stats(&pool, 0, total, 0, 0, count_chunk, add_long, NULL, chunks);
+    double elapsed = bench_now() - start;
+    pool_destroy(&pool);
+
+    long fewest = chunks[0], most = chunks[0];
+    for (int i = 1; i < workers; i++) {
+        fewest = chunks[i] < fewest ? chunks[i] : fewest;
+        most = chunks[i] > most ? chunks[i] : most;
     }
-    for (int i = 0; i < NUM_THREADS; i++) {
-        pthread_join(threads[i], NULL);
+    *lost = total - count;
+    *spread = most > 0 ? 1.0 - (double)fewest / most : 0;
+    return elapsed;
+}
+
+// Run one configuration once; returns elapsed seconds (threads released together),
+// *lost = increments missing, *imbalance = spread of the per-thread rates,
+// *spread = spread of chunks per worker; whichever does not apply is set to -1
+double run_once(counter_impl_t *impl, int nthreads, long *lost, double *imbalance, double *spread) {
+    run_arg_t args[MAX_THREADS];
+    *imbalance = *spread = -1;
+    if (impl->worker == NULL)
+        return run_reduce(nthreads, lost, spread);
+    counter_reset(impl);
+    for (int i = 0; i < nthreads; i++) {
+        args[i].impl = impl;
+        args[i].tid = i;
     }
-    end_time = get_time();
 
-    printf("Value: %d\n", unsafe_counter.value);
-    printf("Time: %.3f seconds\n", end_time - start_time);
-    printf("Error: %d lost\n\n",
-           NUM_THREADS * INCREMENTS_PER_THREAD - unsafe_counter.value);
+    bench_t b = { .nthreads = nthreads, .worker = run_worker, .args = args, .arg_size = sizeof(args[0]),
+                  .ops_per_thread = INCREMENTS_PER_THREAD };
+    bench_run(&b);
 
-    printf("-------------------------------------\n");
+    *lost = (long)nthreads * INCREMENTS_PER_THREAD - counter_value(impl);
+    *imbalance = b.imbalance;
+    return b.seconds;
+}
 
-    // Test thread-safe counter 
-    printf("Test safe counter\n");
-    safe_counter_init(&safe_counter);
+// A ratio column: empty (CSV) or null (JSON) when it does not apply to the row
+void print_ratio(double v, int json) {
+    if (v >= 0)
+        printf("%.3f", v);
+    else if (json)
+        printf("null");
+}
 
-    start_time = get_time();
-    for (int i = 0; i < NUM_THREADS; i++) {
-        pthread_create(&threads[i], NULL, safe_increment, NULL);
+int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    int json = 0;
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            json = 0;
+        } else if (atoi(argv[i]) > 0) {
+            max_threads = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "usage: counter_comparison [--csv|--json] [max_threads]\n");
+            exit(1);
+        }
     }
-    for (int i = 0; i < NUM_THREADS; i++) {
-        pthread_join(threads[i], NULL);
+    if (max_threads < 1)
+        max_threads = 1;
+    if (max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    // Counters are first touched here, on thread 0's node
+    placement_print(placement_default(), stderr);
+    placement_pin_main();
+    pthread_mutex_init(&safe_counter.lock, NULL);
+    pthread_spin_init(&spin_counter.lock, PTHREAD_PROCESS_PRIVATE);
+    lock_init(&lib_counter.lock);
+    sloppy_counter.num_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+    sloppy_counter.local = aligned_alloc(CACHE_LINE_SIZE, sloppy_counter.num_cpus * sizeof(padded_atomic_t));
+    for (int i = 0; i < MAX_THREADS; i++)
+        per_thread[i].value = 0;
+    fc_counter_init(&fc_counter);
+    placement_unpin_main();
+
+    // 1, 2, 4, ... plus max_threads itself
+    int counts[32], num_counts = 0;
+    for (int n = 1; n < max_threads; n *= 2)
+        counts[num_counts++] = n;
+    counts[num_counts++] = max_threads;
+
+    int num_impls = sizeof(impls) / sizeof(impls[0]);
+    int first = 1;
+    if (json)
+        printf("[\n");
+    else
+        printf("counter,param,threads,ops_per_sec,ns_per_op,min_ops_per_sec,max_ops_per_sec,lost,imbalance,chunk_spread\n");
+
+    for (int c = 0; c < num_counts; c++) {
+        int nthreads = counts[c];
+        for (int k = 0; k < num_impls; k++) {
+            counter_impl_t *impl = &impls[k];
+            double times[REPEATS];
+            long lost = 0;
+            double imbalance, spread, worst_imbalance = -1, worst_spread = -1;
+
+            run_once(impl, nthreads, &lost, &imbalance, &spread);   // Warmup: page faults, thread stacks, frequency ramp
+            for (int r = 0; r < REPEATS; r++) {
+                times[r] = run_once(impl, nthreads, &lost, &imbalance, &spread);
+                worst_imbalance = imbalance > worst_imbalance ? imbalance : worst_imbalance;
+                worst_spread = spread > worst_spread ? spread : worst_spread;
+            }
+            qsort(times, REPEATS, sizeof(double), cmp_double);
+
+            double total_ops = (double)nthreads * INCREMENTS_PER_THREAD;
+            double median = times[REPEATS / 2];
+            double ops = total_ops / median;
+            double ns_per_op = median * 1e9 * nthreads / total_ops;
+
+            if (json) {
+                printf("%s  {\"counter\": \"%s\", \"param\": %d, \"threads\": %d, \"ops_per_sec\": %.0f, "
+                       "\"ns_per_op\": %.2f, \"min_ops_per_sec\": %.0f, \"max_ops_per_sec\": %.0f, \"lost\": %ld, "
+                       "\"imbalance\": ",
+                       first ? "" : ",\n", impl->name, impl->param, nthreads, ops, ns_per_op,
+                       total_ops / times[REPEATS - 1], total_ops / times[0], lost);
+                print_ratio(worst_imbalance, json);
+                printf(", \"chunk_spread\": ");
+                print_ratio(worst_spread, json);
+                printf("}");
+            } else {
+                printf("%s,%d,%d,%.0f,%.2f,%.0f,%.0f,%ld,", impl->name, impl->param, nthreads, ops,
+                       ns_per_op, total_ops / times[REPEATS - 1], total_ops / times[0], lost);
+                print_ratio(worst_imbalance, json);
+                printf(",");
+                print_ratio(worst_spread, json);
+                printf("\n");
+            }
+            first = 0;
+            fflush(stdout);
+        }
     }
-    end_time = get_time();
+    if (json)
+        printf("\n]\n");
 
-    printf("Value: %d\n", safe_counter.value);
-    printf("Time: %.3f seconds\n", end_time - start_time);
-    
     // Clean
     pthread_mutex_destroy(&safe_counter.lock);
+    pthread_spin_destroy(&spin_counter.lock);
+    lock_destroy(&lib_counter.lock);
+    free(sloppy_counter.local);
 
     return 0;
 }
@@ -0,0 +1,183 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Flat combining (Hendler, Incze, Shavit, Tzafrir)
+ * Instead of every thread taking the lock and dragging the data structure's cache
+ * lines to its core, each thread writes its request into its own padded slot. Whoever
+ * gets the lock becomes the combiner and applies every pending request in one pass,
+ * so the data stays in one cache and the lock is taken once per batch, not per op.
+ *
+ * The data structure supplies one apply function, called only by the combiner
+ * (so the structure itself needs no synchronization):
+ *     long apply(void *obj, int op, long arg, void *ptr);
+ * Callers pass a small dense thread id (0 .. FC_MAX_THREADS-1) to pick their slot.
+ */
+
+#ifndef __flat_combining_h__
+#define __flat_combining_h__
+
+#include <stdatomic.h>
+#include "locks.h"
+
+#define FC_MAX_THREADS 256
+#define FC_PASSES 3    // Extra scans per combining round, to catch late arrivals
+
+typedef long (*fc_apply_fn)(void *obj, int op, long arg, void *ptr);
+
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_int pending;    // 1 = posted, combiner sets 0 when done
+    int op;
+    long arg;
+    void *ptr;
+    long result;
+} fc_slot_t;
+
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_int lock;
+    atomic_int num_slots;    // 1 + highest thread id seen
+    void *obj;
+    fc_apply_fn apply;
+    fc_slot_t slots[FC_MAX_THREADS];
+} fc_t;
+
+static inline void fc_init(fc_t *fc, void *obj, fc_apply_fn apply) {
+    atomic_init(&fc->lock, 0);
+    atomic_init(&fc->num_slots, 0);
+    fc->obj = obj;
+    fc->apply = apply;
+    for (int i = 0; i < FC_MAX_THREADS; i++)
+        atomic_init(&fc->slots[i].pending, 0);
+}
+
+// Combiner: serve every posted request, a few passes while they keep coming
+static inline void fc_combine(fc_t *fc) {
+    int n = atomic_load_explicit(&fc->num_slots, memory_order_acquire);
+    for (int pass = 0; pass < FC_PASSES; pass++) {
+        int served = 0;
+        for (int i = 0; i < n; i++) {
+            fc_slot_t *s = &fc->slots[i];
+            if (atomic_load_explicit(&s->pending, memory_order_acquire)) {
+                s->result = fc->apply(fc->obj, s->op, s->arg, s->ptr);
+                atomic_store_explicit(&s->pending, 0, memory_order_release);
+                served++;
+            }
+        }
+        if (served == 0)
+            break;
+    }
+}
+
+// Run op on the shared object and return apply's result
+static inline long fc_execute(fc_t *fc, int tid, int op, long arg, void *ptr) {
+    int n = atomic_load_explicit(&fc->num_slots, memory_order_relaxed);
+    while (tid >= n && !atomic_compare_exchange_weak(&fc->num_slots, &n, tid + 1))
+        ;
+
+    fc_slot_t *mine = &fc->slots[tid];
+    mine->op = op;
+    mine->arg = arg;
+    mine->ptr = ptr;
+    atomic_store_explicit(&mine->pending, 1, memory_order_release);
+
+    int spins = 0;
+    while (atomic_load_explicit(&mine->pending, memory_order_acquire)) {
+        int unlocked = 0;
+        if (atomic_load_explicit(&fc->lock, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong_explicit(&fc->lock, &unlocked, 1,
+                memory_order_acquire, memory_order_relaxed)) {
+            fc_combine(fc);
+            atomic_store_explicit(&fc->lock, 0, memory_order_release);
+        } else {
+            lock_spin(&spins);    // Someone is combining, probably our request too
+        }
+    }
+    return mine->result;
+}
+
+// Counter
+enum { FC_COUNTER_ADD, FC_COUNTER_GET };
+
+typedef struct
+{
+    long value;    // Touched only by the combiner
+    fc_t fc;
+} fc_counter_t;
+
+static inline long fc_counter_apply(void *obj, int op, long arg, void *ptr) {
+    (void)ptr;
+    fc_counter_t *c = (fc_counter_t *)obj;
+    if (op == FC_COUNTER_ADD)
+        c->value += arg;
+    return c->value;
+}
+
+static inline void fc_counter_init(fc_counter_t *c) {
+    c->value = 0;
+    fc_init(&c->fc, c, fc_counter_apply);
+}
+
+static inline void fc_counter_add(fc_counter_t *c, int tid, long amt) {
+    fc_execute(&c->fc, tid, FC_COUNTER_ADD, amt, NULL);
+}
+
+static inline long fc_counter_get(fc_counter_t *c, int tid) {
+    return fc_execute(&c->fc, tid, FC_COUNTER_GET, 0, NULL);
+}
+
+// FIFO queue: a plain singly linked list, only the combiner walks it.
+// Nodes are allocated and freed by the callers, outside the combining pass.
+enum { FC_QUEUE_ENQ, FC_QUEUE_DEQ };
+
+typedef struct fc_qnode
+{
+    struct fc_qnode *next;
+    long value;
+} fc_qnode_t;
+
+typedef struct
+{
+    fc_qnode_t *head;
+    fc_qnode_t *tail;
+    fc_t fc;
+} fc_queue_t;
+
+static inline long fc_queue_apply(void *obj, int op, long arg, void *ptr) {
+    (void)arg;
+    fc_queue_t *q = (fc_queue_t *)obj;
+    if (op == FC_QUEUE_ENQ) {
+        fc_qnode_t *n = (fc_qnode_t *)ptr;
+        n->next = NULL;
+        if (q->tail != NULL)
+            q->tail->next = n;
+        else
+            q->head = n;
+        q->tail = n;
+        return 0;
+    }
+    fc_qnode_t *n = q->head;
+    if (n != NULL) {
+        q->head = n->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+    }
+    return (long)n;
+}
+
+static inline void fc_queue_init(fc_queue_t *q) {
+    q->head = NULL;
+    q->tail = NULL;
+    fc_init(&q->fc, q, fc_queue_apply);
+}
+
+static inline void fc_queue_enqueue(fc_queue_t *q, int tid, fc_qnode_t *n) {
+    fc_execute(&q->fc, tid, FC_QUEUE_ENQ, 0, n);
+}
+
+// NULL if empty; the caller owns (and frees) the node
+static inline fc_qnode_t *fc_queue_dequeue(fc_queue_t *q, int tid) {
+    return (fc_qnode_t *)fc_execute(&q->fc, tid, FC_QUEUE_DEQ, 0, NULL);
+}
+
+#endif // __flat_combining_h__
@@ -0,0 +1,47 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Thin wrappers around the Linux futex syscall
+ * futex_wait sleeps only if *addr still equals val, so a wake that lands
+ * between our check and the syscall is never lost.
+ * The *_shared versions work on memory mapped by several processes (MAP_SHARED).
+ */
+
+#ifndef __futex_h__
+#define __futex_h__
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <time.h>
+
+static inline long futex_op(atomic_uint *addr, int op, unsigned val, const struct timespec *timeout) {
+    return syscall(SYS_futex, (unsigned *)addr, op, val, timeout, NULL, 0);
+}
+
+// Process-private: cheaper, the kernel keys the wait queue by virtual address
+static inline void futex_wait(atomic_uint *addr, unsigned val) {
+    futex_op(addr, FUTEX_WAIT_PRIVATE, val, NULL);
+}
+
+static inline void futex_wake(atomic_uint *addr, int n) {
+    futex_op(addr, FUTEX_WAKE_PRIVATE, n, NULL);
+}
+
+// Relative timeout; returns early on wake, signal or timeout
+static inline void futex_wait_timeout(atomic_uint *addr, unsigned val, const struct timespec *timeout) {
+    futex_op(addr, FUTEX_WAIT_PRIVATE, val, timeout);
+}
+
+// Process-shared: addr must live in a MAP_SHARED mapping
+static inline void futex_wait_shared(atomic_uint *addr, unsigned val) {
+    futex_op(addr, FUTEX_WAIT, val, NULL);
+}
+
+static inline void futex_wake_shared(atomic_uint *addr, int n) {
+    futex_op(addr, FUTEX_WAKE, n, NULL);
+}
+
+#endif // __futex_h__
@@ -0,0 +1,113 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Blocking primitives built straight on futex.h
+ *
+ *   fsem_t        counting semaphore. wait() is a CAS when the count is positive,
+ *                 post() an add plus a load when nobody sleeps: no syscalls either way.
+ *   eventcount_t  lets a lock-free structure block its consumers without a mutex:
+ *
+ *       while ((x = try_pop(q)) == NULL) {
+ *           unsigned key = ec_prepare_wait(&ec);
+ *           if ((x = try_pop(q)) != NULL) {    // Re-check after announcing ourselves
+ *               ec_cancel_wait(&ec);
+ *               break;
+ *           }
+ *           ec_commit_wait(&ec, key);           // Sleeps unless a notify came after prepare
+ *       }
+ *
+ *   and the producer does push(q, x); ec_notify_one(&ec); which is a fence and a load
+ *   when nobody is waiting.
+ *
+ * Both work because the waiter announces itself (seq_cst) before its last check and the
+ * waker publishes (seq_cst) before looking for waiters: one of them always sees the other.
+ */
+
+#ifndef __futex_sync_h__
+#define __futex_sync_h__
+
+#include <stdatomic.h>
+#include <limits.h>
+#include "futex.h"
+
+// Semaphore
+typedef struct
+{
+    atomic_uint value;
+    atomic_uint waiters;
+} fsem_t;
+
+static inline void fsem_init(fsem_t *s, unsigned value) {
+    atomic_init(&s->value, value);
+    atomic_init(&s->waiters, 0);
+}
+
+// 1 if we took one, 0 if the count was zero
+static inline int fsem_trywait(fsem_t *s) {
+    unsigned v = atomic_load_explicit(&s->value, memory_order_relaxed);
+    while (v > 0) {
+        if (atomic_compare_exchange_weak_explicit(&s->value, &v, v - 1,
+                memory_order_acquire, memory_order_relaxed))
+            return 1;
+    }
+    return 0;
+}
+
+static inline void fsem_wait(fsem_t *s) {
+    if (fsem_trywait(s))
+        return;
+    atomic_fetch_add_explicit(&s->waiters, 1, memory_order_seq_cst);
+    while (!fsem_trywait(s))
+        futex_wait(&s->value, 0);    // Returns at once if a post got in first
+    atomic_fetch_sub_explicit(&s->waiters, 1, memory_order_relaxed);
+}
+
+static inline void fsem_post(fsem_t *s) {
+    atomic_fetch_add_explicit(&s->value, 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&s->waiters, memory_order_seq_cst) > 0)
+        futex_wake(&s->value, 1);
+}
+
+// Eventcount
+typedef struct
+{
+    atomic_uint epoch;      // Bumped by each notify that finds waiters
+    atomic_uint waiters;    // Between prepare and commit/cancel
+} eventcount_t;
+
+static inline void ec_init(eventcount_t *ec) {
+    atomic_init(&ec->epoch, 0);
+    atomic_init(&ec->waiters, 0);
+}
+
+// Announce we may sleep; re-check the condition after this, then commit or cancel
+static inline unsigned ec_prepare_wait(eventcount_t *ec) {
+    atomic_fetch_add_explicit(&ec->waiters, 1, memory_order_seq_cst);
+    return atomic_load_explicit(&ec->epoch, memory_order_seq_cst);
+}
+
+static inline void ec_cancel_wait(eventcount_t *ec) {
+    atomic_fetch_sub_explicit(&ec->waiters, 1, memory_order_relaxed);
+}
+
+// Sleep until a notify newer than key; may return spuriously, so callers loop
+static inline void ec_commit_wait(eventcount_t *ec, unsigned key) {
+    while (atomic_load_explicit(&ec->epoch, memory_order_acquire) == key)
+        futex_wait(&ec->epoch, key);
+    atomic_fetch_sub_explicit(&ec->waiters, 1, memory_order_relaxed);
+}
+
+static inline void ec_notify(eventcount_t *ec, int n) {
+    // Pairs with the seq_cst ops in ec_prepare_wait: our caller's publish is
+    // visible to any waiter we miss here
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&ec->waiters, memory_order_relaxed) == 0)
+        return;
+    atomic_fetch_add_explicit(&ec->epoch, 1, memory_order_release);
+    futex_wake(&ec->epoch, n);
+}
+
+static inline void ec_notify_one(eventcount_t *ec) { ec_notify(ec, 1); }
+static inline void ec_notify_all(eventcount_t *ec) { ec_notify(ec, INT_MAX); }
+
+#endif // __futex_sync_h__
@@ -0,0 +1,114 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * HDR-style log-linear histogram
+ * Values below 2^HIST_SUB_BITS get one bucket each; above that, every power of two
+ * is split into 2^HIST_SUB_BITS linear sub-buckets, so relative error stays under
+ * 1/2^HIST_SUB_BITS (~3%) from nanoseconds to hours.
+ *
+ * Not thread-safe on purpose: give each thread its own histogram and merge at the end.
+ */
+
+#ifndef __histogram_h__
+#define __histogram_h__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_NUM_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_NUM_BUCKETS];
+} histogram_t;
+
+static inline void hist_init(histogram_t *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline int hist_bucket(uint64_t v) {
+    if (v < HIST_SUB_COUNT)
+        return (int)v;
+    int exp = 63 - __builtin_clzll(v);          // Position of the top bit
+    int shift = exp - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + (int)((v >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+// Largest value that lands in bucket idx
+static inline uint64_t hist_bucket_high(int idx) {
+    if (idx < HIST_SUB_COUNT)
+        return idx;
+    int shift = idx / HIST_SUB_COUNT - 1;
+    uint64_t base = (uint64_t)(HIST_SUB_COUNT + idx % HIST_SUB_COUNT) << shift;
+    return base + ((1ULL << shift) - 1);
+}
+
+static inline void hist_record(histogram_t *h, uint64_t v) {
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static inline void hist_merge(histogram_t *dst, const histogram_t *src) {
+    for (int i = 0; i < HIST_NUM_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+// Value at percentile p (0-100), accurate to one bucket
+static inline uint64_t hist_percentile(const histogram_t *h, double p) {
+    if (h->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_NUM_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = hist_bucket_high(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static inline void hist_print(const histogram_t *h, const char *name, const char *unit) {
+    printf("%s: count=%llu mean=%.0f p50=%llu p99=%llu p99.9=%llu max=%llu (%s)\n", name,
+           (unsigned long long)h->count, h->count ? (double)h->sum / h->count : 0.0,
+           (unsigned long long)hist_percentile(h, 50),
+           (unsigned long long)hist_percentile(h, 99),
+           (unsigned long long)hist_percentile(h, 99.9),
+           (unsigned long long)h->max, unit);
+}
+
+// One row per non-empty bucket: label,bucket_high,count,cumulative_fraction
+static inline void hist_dump_csv(const histogram_t *h, FILE *out, const char *label) {
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_NUM_BUCKETS; i++) {
+        if (h->buckets[i] == 0)
+            continue;
+        seen += h->buckets[i];
+        fprintf(out, "%s,%llu,%llu,%.6f\n", label, (unsigned long long)hist_bucket_high(i),
+                (unsigned long long)h->buckets[i], (double)seen / h->count);
+    }
+}
+
+#endif // __histogram_h__
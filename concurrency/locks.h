@@ -0,0 +1,455 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Lock library with one interface, picked at compile time:
+ *   gcc -DLOCK_IMPL=mcs concurrent_hash.c
+ *
+ *   mutex    pthread_mutex_t (default)
+ *   ttas     test-and-test-and-set with exponential backoff
+ *   ticket   FIFO ticket lock
+ *   mcs      MCS queue lock: each waiter spins on its own node
+ *   clh      CLH queue lock: each waiter spins on its predecessor's node
+ *   futex    two-phase lock: spin briefly, then sleep in the kernel (Drepper's mutex)
+ *   adaptive futex lock whose spin budget follows the recent hold times, and which
+ *            parks at once when the owner can't be running (same CPU, or overdue)
+ *
+ * All of them expose <impl>_init/_acquire/_release/_destroy, and lock_t/lock_* map to the chosen one.
+ * MCS and CLH queue nodes come from a small per-thread pool, so callers don't pass nodes around
+ * and may hold up to LOCK_MAX_HELD queue locks at once, released in any order.
+ *
+ * Pure spinning is a disaster when threads outnumber CPUs: the holder (or, for the FIFO locks,
+ * the waiter next in line) may be descheduled, and every handoff then waits out a time slice.
+ * So spin loops yield after a short budget (none at all on a single CPU), and a ticket
+ * waiter that is not next in line yields right away.
+ */
+
+#ifndef __locks_h__
+#define __locks_h__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE    // sched_getcpu; include this header before other system headers
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "futex.h"
+
+#ifndef LOCK_IMPL
+#define LOCK_IMPL mutex
+#endif
+
+#define LOCK_CACHE_LINE 64
+#define LOCK_SPIN_LIMIT 256
+#define LOCK_MAX_HELD 8
+#define TTAS_BACKOFF_MIN 4
+#define TTAS_BACKOFF_MAX 1024
+#define FUTEX_SPIN_TRIES 100
+#define ADAPTIVE_SPIN_MIN 256       // Ticks (TSC cycles, or ns without a TSC)
+#define ADAPTIVE_SPIN_MAX 65536
+#define ADAPTIVE_SAMPLE_EVERY 16
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+// Spin iterations before yielding; 0 on one CPU, where the holder can't run while we spin
+static inline int lock_spin_budget(void) {
+    static atomic_int budget = -1;
+    int b = atomic_load_explicit(&budget, memory_order_relaxed);
+    if (b < 0) {
+        b = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? LOCK_SPIN_LIMIT : 0;
+        atomic_store_explicit(&budget, b, memory_order_relaxed);
+    }
+    return b;
+}
+
+// Call once per spin iteration
+static inline void lock_spin(int *spins) {
+    if (++*spins < lock_spin_budget()) {
+        cpu_relax();
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+// pthread mutex
+typedef struct
+{
+    pthread_mutex_t m;
+} mutex_lock_t;
+
+static inline void mutex_init(mutex_lock_t *l) { pthread_mutex_init(&l->m, NULL); }
+static inline void mutex_acquire(mutex_lock_t *l) { pthread_mutex_lock(&l->m); }
+static inline void mutex_release(mutex_lock_t *l) { pthread_mutex_unlock(&l->m); }
+static inline void mutex_destroy(mutex_lock_t *l) { pthread_mutex_destroy(&l->m); }
+
+// Test-and-test-and-set: spin on a plain load (stays in our cache) and only
+// try the exchange when the lock looks free; back off after losing a race
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_int locked;
+} ttas_lock_t;
+
+static inline void ttas_init(ttas_lock_t *l) { atomic_init(&l->locked, 0); }
+
+static inline void ttas_acquire(ttas_lock_t *l) {
+    int backoff = TTAS_BACKOFF_MIN, spins = 0;
+    while (1) {
+        while (atomic_load_explicit(&l->locked, memory_order_relaxed))
+            lock_spin(&spins);
+        if (!atomic_exchange_explicit(&l->locked, 1, memory_order_acquire))
+            return;
+        for (int i = 0; i < backoff; i++)
+            cpu_relax();
+        if (backoff < TTAS_BACKOFF_MAX)
+            backoff *= 2;
+    }
+}
+
+static inline void ttas_release(ttas_lock_t *l) {
+    atomic_store_explicit(&l->locked, 0, memory_order_release);
+}
+
+static inline void ttas_destroy(ttas_lock_t *l) { (void)l; }
+
+// Ticket: take a number, wait until it is served
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_uint next;
+    _Alignas(LOCK_CACHE_LINE) atomic_uint serving;
+} ticket_lock_t;
+
+static inline void ticket_init(ticket_lock_t *l) {
+    atomic_init(&l->next, 0);
+    atomic_init(&l->serving, 0);
+}
+
+static inline void ticket_acquire(ticket_lock_t *l) {
+    unsigned my = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+    int spins = 0;
+    while (1) {
+        unsigned cur = atomic_load_explicit(&l->serving, memory_order_acquire);
+        if (cur == my)
+            return;
+        // Others are ahead of us: nothing to gain by burning a CPU they may need
+        if (my - cur > 1) {
+            sched_yield();
+            continue;
+        }
+        lock_spin(&spins);
+    }
+}
+
+static inline void ticket_release(ticket_lock_t *l) {
+    unsigned cur = atomic_load_explicit(&l->serving, memory_order_relaxed);
+    atomic_store_explicit(&l->serving, cur + 1, memory_order_release);
+}
+
+static inline void ticket_destroy(ticket_lock_t *l) { (void)l; }
+
+// MCS
+typedef struct mcs_node
+{
+    _Alignas(LOCK_CACHE_LINE) _Atomic(struct mcs_node *) next;
+    atomic_int locked;
+} mcs_node_t;
+
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) _Atomic(mcs_node_t *) tail;
+    mcs_node_t *holder;    // Node of the current owner, only touched by the owner
+} mcs_lock_t;
+
+static __thread mcs_node_t mcs_pool[LOCK_MAX_HELD];
+static __thread unsigned mcs_pool_used;
+
+static inline void mcs_init(mcs_lock_t *l) {
+    atomic_init(&l->tail, NULL);
+    l->holder = NULL;
+}
+
+static inline void mcs_acquire(mcs_lock_t *l) {
+    assert(mcs_pool_used != (1u << LOCK_MAX_HELD) - 1);
+    int idx = __builtin_ctz(~mcs_pool_used);
+    mcs_pool_used |= 1u << idx;
+    mcs_node_t *node = &mcs_pool[idx];
+
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+    mcs_node_t *pred = atomic_exchange_explicit(&l->tail, node, memory_order_acq_rel);
+    if (pred != NULL) {
+        atomic_store_explicit(&pred->next, node, memory_order_release);
+        int spins = 0;
+        while (atomic_load_explicit(&node->locked, memory_order_acquire))
+            lock_spin(&spins);
+    }
+    l->holder = node;
+}
+
+static inline void mcs_release(mcs_lock_t *l) {
+    mcs_node_t *node = l->holder;
+    mcs_node_t *next = atomic_load_explicit(&node->next, memory_order_acquire);
+
+    if (next == NULL) {
+        // No visible successor: try to swing tail back to empty
+        mcs_node_t *expected = node;
+        if (atomic_compare_exchange_strong_explicit(&l->tail, &expected, NULL,
+                memory_order_release, memory_order_relaxed)) {
+            mcs_pool_used &= ~(1u << (node - mcs_pool));
+            return;
+        }
+        // Someone is between the exchange and linking in, wait for them
+        int spins = 0;
+        while ((next = atomic_load_explicit(&node->next, memory_order_acquire)) == NULL)
+            lock_spin(&spins);
+    }
+    atomic_store_explicit(&next->locked, 0, memory_order_release);
+    mcs_pool_used &= ~(1u << (node - mcs_pool));
+}
+
+static inline void mcs_destroy(mcs_lock_t *l) { (void)l; }
+
+// CLH: the lock always points at the last node; releasing hands our node to the
+// successor and we adopt the predecessor's node for next time
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_int locked;
+} clh_node_t;
+
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) _Atomic(clh_node_t *) tail;
+    clh_node_t *holder;
+    clh_node_t *holder_pred;
+    int holder_slot;
+} clh_lock_t;
+
+static __thread clh_node_t *clh_pool[LOCK_MAX_HELD];
+static __thread unsigned clh_pool_used;
+static pthread_key_t clh_pool_key;
+static pthread_once_t clh_pool_once = PTHREAD_ONCE_INIT;
+
+// Thread exit: the free slots hold nodes nobody else references any more
+static void clh_pool_free(void *unused) {
+    (void)unused;
+    for (int i = 0; i < LOCK_MAX_HELD; i++) {
+        if (!(clh_pool_used & (1u << i))) {
+            free(clh_pool[i]);
+            clh_pool[i] = NULL;
+        }
+    }
+}
+
+static void clh_pool_key_create(void) {
+    pthread_key_create(&clh_pool_key, clh_pool_free);
+}
+
+static inline clh_node_t *clh_node_new(void) {
+    clh_node_t *n = aligned_alloc(LOCK_CACHE_LINE, sizeof(clh_node_t));
+    atomic_init(&n->locked, 0);
+    return n;
+}
+
+// First node for this thread: arrange for the pool to be freed when it exits
+static inline clh_node_t *clh_pool_node_new(void) {
+    pthread_once(&clh_pool_once, clh_pool_key_create);
+    if (pthread_getspecific(clh_pool_key) == NULL)
+        pthread_setspecific(clh_pool_key, (void *)1);
+    return clh_node_new();
+}
+
+static inline void clh_init(clh_lock_t *l) {
+    atomic_init(&l->tail, clh_node_new());    // Dummy, already released
+    l->holder = NULL;
+    l->holder_pred = NULL;
+}
+
+static inline void clh_acquire(clh_lock_t *l) {
+    assert(clh_pool_used != (1u << LOCK_MAX_HELD) - 1);
+    int idx = __builtin_ctz(~clh_pool_used);
+    clh_pool_used |= 1u << idx;
+    if (clh_pool[idx] == NULL)
+        clh_pool[idx] = clh_pool_node_new();
+    clh_node_t *node = clh_pool[idx];
+
+    atomic_store_explicit(&node->locked, 1, memory_order_relaxed);
+    clh_node_t *pred = atomic_exchange_explicit(&l->tail, node, memory_order_acq_rel);
+    int spins = 0;
+    while (atomic_load_explicit(&pred->locked, memory_order_acquire))
+        lock_spin(&spins);
+
+    l->holder = node;
+    l->holder_pred = pred;
+    l->holder_slot = idx;
+}
+
+static inline void clh_release(clh_lock_t *l) {
+    clh_node_t *node = l->holder;
+    int idx = l->holder_slot;
+    clh_pool[idx] = l->holder_pred;    // Nobody spins on pred any more, it is ours now
+    clh_pool_used &= ~(1u << idx);
+    atomic_store_explicit(&node->locked, 0, memory_order_release);
+}
+
+// Must be unlocked: the tail node then belongs to the lock
+static inline void clh_destroy(clh_lock_t *l) {
+    free(atomic_load(&l->tail));
+}
+
+// Futex two-phase: 0 = unlocked, 1 = locked, 2 = locked and maybe waiters
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_uint state;
+} futex_lock_t;
+
+static inline void futex_init(futex_lock_t *l) { atomic_init(&l->state, 0); }
+
+static inline void futex_acquire(futex_lock_t *l) {
+    // Phase 1: spin, the holder is probably about to leave
+    for (int i = 0; i < FUTEX_SPIN_TRIES; i++) {
+        unsigned c = 0;
+        if (atomic_compare_exchange_weak_explicit(&l->state, &c, 1,
+                memory_order_acquire, memory_order_relaxed))
+            return;
+        cpu_relax();
+    }
+    // Phase 2: mark contended and sleep until we get it
+    unsigned c = atomic_exchange_explicit(&l->state, 2, memory_order_acquire);
+    while (c != 0) {
+        futex_wait(&l->state, 2);
+        c = atomic_exchange_explicit(&l->state, 2, memory_order_acquire);
+    }
+}
+
+static inline void futex_release(futex_lock_t *l) {
+    // 1 -> 0 means nobody waited: no syscall
+    if (atomic_fetch_sub_explicit(&l->state, 1, memory_order_release) != 1) {
+        atomic_store_explicit(&l->state, 0, memory_order_release);
+        futex_wake(&l->state, 1);
+    }
+}
+
+static inline void futex_destroy(futex_lock_t *l) { (void)l; }
+
+// Adaptive: the futex lock's states, plus what the owner leaves for waiters to judge by.
+// A waiter spins for about twice the recent average hold time, but parks at once if the
+// owner is on the waiter's own CPU (so it can't be running). Every ADAPTIVE_SAMPLE_EVERY-th
+// owner times its hold and folds it into the average, keeping the uncontended path to a
+// CAS plus sched_getcpu() (an rseq read, no syscall).
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_uint state;
+    atomic_int owner_cpu;
+    _Atomic uint64_t avg_hold;    // Ticks, EWMA with 1/8 weight per sample
+    uint64_t acquired_at;         // Owner only; 0 when this hold isn't sampled
+    unsigned acquires;            // Owner only
+} adaptive_lock_t;
+
+// TSC cycles where there is one, else nanoseconds
+static inline uint64_t adaptive_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static inline void adaptive_init(adaptive_lock_t *l) {
+    atomic_init(&l->state, 0);
+    atomic_init(&l->owner_cpu, -1);
+    atomic_init(&l->avg_hold, ADAPTIVE_SPIN_MIN);
+    l->acquired_at = 0;
+    l->acquires = 0;
+}
+
+static inline void adaptive_acquired(adaptive_lock_t *l) {
+    atomic_store_explicit(&l->owner_cpu, sched_getcpu(), memory_order_relaxed);
+    l->acquired_at = ++l->acquires % ADAPTIVE_SAMPLE_EVERY == 0 ? adaptive_ticks() : 0;
+}
+
+static inline void adaptive_acquire(adaptive_lock_t *l) {
+    unsigned c = 0;
+    if (atomic_compare_exchange_strong_explicit(&l->state, &c, 1, memory_order_acquire, memory_order_relaxed)) {
+        adaptive_acquired(l);
+        return;
+    }
+
+    // Spin phase; skipped on one CPU, where the owner can't run while we spin
+    if (lock_spin_budget() > 0) {
+        uint64_t budget = 2 * atomic_load_explicit(&l->avg_hold, memory_order_relaxed);
+        budget = budget < ADAPTIVE_SPIN_MIN ? ADAPTIVE_SPIN_MIN : budget > ADAPTIVE_SPIN_MAX ? ADAPTIVE_SPIN_MAX : budget;
+        int cpu = sched_getcpu();
+        uint64_t start = adaptive_ticks();
+
+        for (int i = 1; ; i++) {
+            c = atomic_load_explicit(&l->state, memory_order_relaxed);
+            if (c == 0 && atomic_compare_exchange_weak_explicit(&l->state, &c, 1,
+                    memory_order_acquire, memory_order_relaxed)) {
+                adaptive_acquired(l);
+                return;
+            }
+            if (atomic_load_explicit(&l->owner_cpu, memory_order_relaxed) == cpu)
+                break;
+            // Reading the clock costs more than a pause; look every 8 rounds
+            if (i % 8 == 0 && adaptive_ticks() - start > budget)
+                break;
+            cpu_relax();
+        }
+    }
+
+    // Park, as in futex_acquire
+    c = atomic_exchange_explicit(&l->state, 2, memory_order_acquire);
+    while (c != 0) {
+        futex_wait(&l->state, 2);
+        c = atomic_exchange_explicit(&l->state, 2, memory_order_acquire);
+    }
+    adaptive_acquired(l);
+}
+
+static inline void adaptive_release(adaptive_lock_t *l) {
+    if (l->acquired_at != 0) {
+        // Only owners write avg_hold, so load + store is enough
+        uint64_t hold = adaptive_ticks() - l->acquired_at;
+        uint64_t avg = atomic_load_explicit(&l->avg_hold, memory_order_relaxed);
+        atomic_store_explicit(&l->avg_hold, avg - avg / 8 + hold / 8, memory_order_relaxed);
+    }
+    atomic_store_explicit(&l->owner_cpu, -1, memory_order_relaxed);
+
+    if (atomic_fetch_sub_explicit(&l->state, 1, memory_order_release) != 1) {
+        atomic_store_explicit(&l->state, 0, memory_order_release);
+        futex_wake(&l->state, 1);
+    }
+}
+
+static inline void adaptive_destroy(adaptive_lock_t *l) { (void)l; }
+
+// Compile-time selection
+#define LOCK_CAT2(a, b) a##b
+#define LOCK_CAT(a, b) LOCK_CAT2(a, b)
+#define LOCK_STR2(a) #a
+#define LOCK_STR(a) LOCK_STR2(a)
+#define LOCK_NAME LOCK_STR(LOCK_IMPL)
+
+typedef LOCK_CAT(LOCK_IMPL, _lock_t) lock_t;
+
+static inline void lock_init(lock_t *l) { LOCK_CAT(LOCK_IMPL, _init)(l); }
+static inline void lock_acquire(lock_t *l) { LOCK_CAT(LOCK_IMPL, _acquire)(l); }
+static inline void lock_release(lock_t *l) { LOCK_CAT(LOCK_IMPL, _release)(l); }
+static inline void lock_destroy(lock_t *l) { LOCK_CAT(LOCK_IMPL, _destroy)(l); }
+
+#endif // __locks_h__
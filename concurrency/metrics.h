@@ -0,0 +1,312 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * In-process metrics registry
+ *   counter:   per-CPU padded slots, same design as sloppy_counter.c (no mutex on update)
+ *   gauge:     one atomic
+ *   histogram: one log-linear histogram (histogram.h) per thread, merged at snapshot time
+ *
+ * Registration takes a mutex (cold path). Updates never do. A snapshot only reads,
+ * so updaters are never stalled by it; it may see a histogram mid-update, which
+ * costs at most a count of one in a bucket.
+ */
+
+#ifndef __metrics_h__
+#define __metrics_h__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE    // sched_getcpu; include this header before other system headers
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <time.h>
+#include "histogram.h"
+
+#define METRICS_MAX 128
+#define METRICS_MAX_THREADS 256
+#define METRICS_NAME_LEN 64
+#define METRICS_CACHE_LINE 64
+
+typedef enum { METRIC_COUNTER, METRIC_GAUGE, METRIC_HISTOGRAM } metric_kind_t;
+
+typedef struct
+{
+    _Alignas(METRICS_CACHE_LINE) atomic_long value;
+} metric_slot_t;
+
+typedef struct
+{
+    char name[METRICS_NAME_LEN];
+    metric_kind_t kind;
+    metric_slot_t *cpu_slots;                                 // counter
+    metric_slot_t gauge;                                      // gauge
+    _Atomic(histogram_t *) thread_hists[METRICS_MAX_THREADS]; // histogram, allocated on first record
+} metric_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;     // Registration only
+    metric_t *metrics[METRICS_MAX];
+    atomic_int num_metrics;
+    int num_cpus;
+
+    // Periodic reporter
+    pthread_t reporter;
+    atomic_int reporter_running;
+    int interval_ms;
+    FILE *out;
+    int json;
+} metrics_registry_t;
+
+// Dense per-thread index, handed out on first histogram record and returned
+// when the thread exits, so the next thread takes over that histogram (and its
+// samples). Only METRICS_MAX_THREADS threads can record at the same time;
+// records from any beyond that are dropped and counted, never shared.
+#define METRICS_TID_WORDS (METRICS_MAX_THREADS / 64)
+static _Atomic(unsigned long) metrics_tid_used[METRICS_TID_WORDS];
+static atomic_long metrics_dropped = 0;
+static pthread_key_t metrics_tid_key;
+static pthread_once_t metrics_tid_once = PTHREAD_ONCE_INIT;
+static __thread int metrics_tid = -1;
+
+static void metrics_tid_release(void *arg) {
+    int tid = (int)(long)arg - 1;
+    // Release: our histogram writes happen before the next owner's
+    atomic_fetch_and_explicit(&metrics_tid_used[tid / 64], ~(1UL << (tid % 64)), memory_order_release);
+    metrics_tid = -1;
+}
+
+static void metrics_tid_key_create(void) {
+    pthread_key_create(&metrics_tid_key, metrics_tid_release);
+}
+
+// Cold path, once per thread: claim a free index. -1 if all are taken.
+static inline int metrics_tid_claim(void) {
+    pthread_once(&metrics_tid_once, metrics_tid_key_create);
+    for (int w = 0; w < METRICS_TID_WORDS; w++) {
+        unsigned long used = atomic_load_explicit(&metrics_tid_used[w], memory_order_relaxed);
+        while (~used != 0) {
+            int bit = __builtin_ctzl(~used);
+            if (atomic_compare_exchange_weak_explicit(&metrics_tid_used[w], &used, used | (1UL << bit),
+                    memory_order_acquire, memory_order_relaxed)) {
+                int tid = w * 64 + bit;
+                pthread_setspecific(metrics_tid_key, (void *)(long)(tid + 1));
+                return tid;
+            }
+        }
+    }
+    return -1;
+}
+
+static inline void metrics_init(metrics_registry_t *r) {
+    pthread_mutex_init(&r->lock, NULL);
+    atomic_init(&r->num_metrics, 0);
+    r->num_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (r->num_cpus < 1)
+        r->num_cpus = 1;
+    atomic_init(&r->reporter_running, 0);
+}
+
+// Find or create a metric. Call once and keep the pointer; lookups are linear.
+static inline metric_t *metrics_register(metrics_registry_t *r, const char *name, metric_kind_t kind) {
+    pthread_mutex_lock(&r->lock);
+    int n = atomic_load(&r->num_metrics);
+    for (int i = 0; i < n; i++) {
+        if (strcmp(r->metrics[i]->name, name) == 0 && r->metrics[i]->kind == kind) {
+            pthread_mutex_unlock(&r->lock);
+            return r->metrics[i];
+        }
+    }
+    if (n == METRICS_MAX) {
+        pthread_mutex_unlock(&r->lock);
+        return NULL;
+    }
+
+    metric_t *m = aligned_alloc(METRICS_CACHE_LINE, sizeof(metric_t));
+    memset(m, 0, sizeof(*m));
+    snprintf(m->name, METRICS_NAME_LEN, "%s", name);
+    m->kind = kind;
+    if (kind == METRIC_COUNTER) {
+        m->cpu_slots = aligned_alloc(METRICS_CACHE_LINE, r->num_cpus * sizeof(metric_slot_t));
+        for (int i = 0; i < r->num_cpus; i++)
+            atomic_init(&m->cpu_slots[i].value, 0);
+    }
+
+    r->metrics[n] = m;
+    atomic_store(&r->num_metrics, n + 1);   // Publish after the metric is complete
+    pthread_mutex_unlock(&r->lock);
+    return m;
+}
+
+static inline metric_t *metrics_counter(metrics_registry_t *r, const char *name) {
+    return metrics_register(r, name, METRIC_COUNTER);
+}
+
+static inline metric_t *metrics_gauge(metrics_registry_t *r, const char *name) {
+    return metrics_register(r, name, METRIC_GAUGE);
+}
+
+static inline metric_t *metrics_histogram(metrics_registry_t *r, const char *name) {
+    return metrics_register(r, name, METRIC_HISTOGRAM);
+}
+
+// Hot path: uncontended add on this CPU's cache line
+static inline void counter_add(metrics_registry_t *r, metric_t *m, long n) {
+    int cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= r->num_cpus)
+        cpu = 0;
+    atomic_fetch_add_explicit(&m->cpu_slots[cpu].value, n, memory_order_relaxed);
+}
+
+static inline void gauge_set(metric_t *m, long v) {
+    atomic_store_explicit(&m->gauge.value, v, memory_order_relaxed);
+}
+
+static inline void gauge_add(metric_t *m, long n) {
+    atomic_fetch_add_explicit(&m->gauge.value, n, memory_order_relaxed);
+}
+
+// Only this thread writes its histogram, so plain load + relaxed store is enough
+// (no lock prefix); the atomic store just keeps a concurrent snapshot well-defined.
+static inline void histogram_record(metric_t *m, uint64_t v) {
+    if (metrics_tid < 0) {
+        metrics_tid = metrics_tid_claim();
+        if (metrics_tid < 0) {
+            atomic_fetch_add_explicit(&metrics_dropped, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    histogram_t *h = atomic_load_explicit(&m->thread_hists[metrics_tid], memory_order_relaxed);
+    if (h == NULL) {
+        h = malloc(sizeof(histogram_t));
+        hist_init(h);
+        atomic_store_explicit(&m->thread_hists[metrics_tid], h, memory_order_release);
+    }
+
+    uint64_t *b = &h->buckets[hist_bucket(v)];
+    __atomic_store_n(b, *b + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->sum, h->sum + v, __ATOMIC_RELAXED);
+    if (v < h->min)
+        __atomic_store_n(&h->min, v, __ATOMIC_RELAXED);
+    if (v > h->max)
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+static inline long counter_read(metrics_registry_t *r, metric_t *m) {
+    long total = 0;
+    for (int i = 0; i < r->num_cpus; i++)
+        total += atomic_load_explicit(&m->cpu_slots[i].value, memory_order_relaxed);
+    return total;
+}
+
+// Merge every thread's histogram into out
+static inline void histogram_read(metric_t *m, histogram_t *out) {
+    hist_init(out);
+    for (int t = 0; t < METRICS_MAX_THREADS; t++) {
+        histogram_t *h = atomic_load_explicit(&m->thread_hists[t], memory_order_acquire);
+        if (h == NULL)
+            continue;
+        for (int i = 0; i < HIST_NUM_BUCKETS; i++)
+            out->buckets[i] += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+        out->count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+        out->sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+        uint64_t mn = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+        uint64_t mx = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+        if (mn < out->min)
+            out->min = mn;
+        if (mx > out->max)
+            out->max = mx;
+    }
+}
+
+// Aggregate everything and print it, as text or one JSON object per call
+static inline void metrics_dump(metrics_registry_t *r, FILE *out, int json) {
+    int n = atomic_load(&r->num_metrics);
+    histogram_t *h = malloc(sizeof(histogram_t));
+
+    if (json)
+        fprintf(out, "{");
+    for (int i = 0; i < n; i++) {
+        metric_t *m = r->metrics[i];
+        const char *sep = i > 0 ? ", " : "";
+
+        if (m->kind == METRIC_COUNTER || m->kind == METRIC_GAUGE) {
+            long v = m->kind == METRIC_COUNTER ? counter_read(r, m)
+                                               : atomic_load_explicit(&m->gauge.value, memory_order_relaxed);
+            if (json)
+                fprintf(out, "%s\"%s\": %ld", sep, m->name, v);
+            else
+                fprintf(out, "%-24s %-9s %ld\n", m->name, m->kind == METRIC_COUNTER ? "counter" : "gauge", v);
+        } else {
+            histogram_read(m, h);
+            unsigned long long p50 = hist_percentile(h, 50), p99 = hist_percentile(h, 99);
+            unsigned long long p999 = hist_percentile(h, 99.9), max = h->max;
+            if (json)
+                fprintf(out, "%s\"%s\": {\"count\": %llu, \"p50\": %llu, \"p99\": %llu, \"p99.9\": %llu, \"max\": %llu}",
+                        sep, m->name, (unsigned long long)h->count, p50, p99, p999, max);
+            else
+                fprintf(out, "%-24s %-9s count=%llu p50=%llu p99=%llu p99.9=%llu max=%llu\n", m->name, "histogram",
+                        (unsigned long long)h->count, p50, p99, p999, max);
+        }
+    }
+    long dropped = atomic_load_explicit(&metrics_dropped, memory_order_relaxed);
+    if (json)
+        fprintf(out, "%s\"histogram_samples_dropped\": %ld}\n", n > 0 ? ", " : "", dropped);
+    else if (dropped > 0)
+        fprintf(out, "%-24s %-9s %ld (more than %d threads recording at once)\n",
+                "histogram_samples_dropped", "counter", dropped, METRICS_MAX_THREADS);
+    fflush(out);
+    free(h);
+}
+
+static inline void *metrics_reporter_main(void *arg) {
+    metrics_registry_t *r = (metrics_registry_t *)arg;
+    struct timespec ts = { r->interval_ms / 1000, (r->interval_ms % 1000) * 1000000L };
+
+    while (atomic_load(&r->reporter_running)) {
+        nanosleep(&ts, NULL);
+        if (!atomic_load(&r->reporter_running))
+            break;
+        if (!r->json)
+            fprintf(r->out, "--- metrics ---\n");
+        metrics_dump(r, r->out, r->json);
+    }
+    return NULL;
+}
+
+// Dump every interval_ms from a background thread
+static inline void metrics_reporter_start(metrics_registry_t *r, int interval_ms, FILE *out, int json) {
+    r->interval_ms = interval_ms;
+    r->out = out;
+    r->json = json;
+    atomic_store(&r->reporter_running, 1);
+    pthread_create(&r->reporter, NULL, metrics_reporter_main, r);
+}
+
+static inline void metrics_reporter_stop(metrics_registry_t *r) {
+    if (!atomic_exchange(&r->reporter_running, 0))
+        return;
+    pthread_join(r->reporter, NULL);
+}
+
+static inline void metrics_destroy(metrics_registry_t *r) {
+    metrics_reporter_stop(r);
+    int n = atomic_load(&r->num_metrics);
+    for (int i = 0; i < n; i++) {
+        metric_t *m = r->metrics[i];
+        free(m->cpu_slots);
+        for (int t = 0; t < METRICS_MAX_THREADS; t++)
+            free(atomic_load(&m->thread_hists[t]));
+        free(m);
+    }
+    pthread_mutex_destroy(&r->lock);
+}
+
+#endif // __metrics_h__
@@ -0,0 +1,213 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Zero-copy message queue over a segmented buffer
+ * Producers reserve space in place, write the payload, then commit.
+ * Consumers read the payload in place, then release it.
+ * Same two-lock idea as concurrent_queue.c: tail_lock for reserve, head_lock for read,
+ * and the locks only cover cursor updates, never the payload bytes.
+ *
+ * A segment is recycled when its reference count drops to zero. References:
+ * one for the tail cursor, one for the head cursor, one per unreleased message.
+ *
+ * Messages are handed out in reserve order, so a reserved but not yet committed
+ * message holds back everything behind it (just like a FIFO should).
+ */
+
+#ifndef __msg_queue_h__
+#define __msg_queue_h__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#define MSGQ_SEG_SIZE (64 * 1024)   // Bytes per segment, largest message is a bit less
+#define MSGQ_NUM_SEGS 64
+
+enum { MSG_RESERVED = 1, MSG_COMMITTED = 2 };
+
+// Sits right in front of every payload
+typedef struct
+{
+    uint32_t len;          // Payload bytes
+    atomic_uint state;
+} msg_hdr_t;
+
+typedef struct
+{
+    _Alignas(64) atomic_uint write_off;   // End of reserved space, written under tail_lock
+    atomic_int next;                      // Next segment, -1 until this one is full
+    atomic_int refs;
+    int next_free;                        // Free list link
+    _Alignas(8) char data[MSGQ_SEG_SIZE];
+} msg_seg_t;
+
+typedef struct
+{
+    msg_seg_t *segs;
+    int num_segs;
+
+    _Alignas(64) pthread_mutex_t tail_lock;
+    int tail_seg;
+
+    _Alignas(64) pthread_mutex_t head_lock;
+    int head_seg;
+    uint32_t head_off;
+
+    _Alignas(64) pthread_mutex_t free_lock;
+    int free_head;
+} msg_queue_t;
+
+static inline uint32_t msgq_record_size(uint32_t len) {
+    return (sizeof(msg_hdr_t) + len + 7) & ~7u;
+}
+
+static inline void msgq_seg_reset(msg_seg_t *s) {
+    atomic_store_explicit(&s->write_off, 0, memory_order_relaxed);
+    atomic_store_explicit(&s->next, -1, memory_order_relaxed);
+    atomic_store_explicit(&s->refs, 2, memory_order_relaxed);   // Tail + head cursor
+}
+
+static inline void msgq_init(msg_queue_t *q) {
+    q->num_segs = MSGQ_NUM_SEGS;
+    q->segs = aligned_alloc(64, MSGQ_NUM_SEGS * sizeof(msg_seg_t));
+    assert(q->segs != NULL);
+
+    // Segment 0 starts as both head and tail, the rest go on the free list
+    msgq_seg_reset(&q->segs[0]);
+    q->free_head = -1;
+    for (int i = MSGQ_NUM_SEGS - 1; i >= 1; i--) {
+        q->segs[i].next_free = q->free_head;
+        q->free_head = i;
+    }
+
+    pthread_mutex_init(&q->tail_lock, NULL);
+    q->tail_seg = 0;
+    pthread_mutex_init(&q->head_lock, NULL);
+    q->head_seg = 0;
+    q->head_off = 0;
+    pthread_mutex_init(&q->free_lock, NULL);
+}
+
+static inline void msgq_seg_unref(msg_queue_t *q, int idx) {
+    if (atomic_fetch_sub(&q->segs[idx].refs, 1) != 1)
+        return;
+    pthread_mutex_lock(&q->free_lock);
+    q->segs[idx].next_free = q->free_head;
+    q->free_head = idx;
+    pthread_mutex_unlock(&q->free_lock);
+}
+
+static inline int msgq_seg_alloc(msg_queue_t *q) {
+    pthread_mutex_lock(&q->free_lock);
+    int idx = q->free_head;
+    if (idx >= 0)
+        q->free_head = q->segs[idx].next_free;
+    pthread_mutex_unlock(&q->free_lock);
+    if (idx >= 0)
+        msgq_seg_reset(&q->segs[idx]);
+    return idx;
+}
+
+static inline int msgq_seg_of(msg_queue_t *q, void *payload) {
+    return (int)(((char *)payload - (char *)q->segs) / sizeof(msg_seg_t));
+}
+
+// Reserve len bytes in place. Returns NULL if every segment is in use
+// (consumers are behind) or len can never fit.
+static inline void *msgq_reserve(msg_queue_t *q, uint32_t len) {
+    // Check before rounding: a len near UINT32_MAX would wrap the size to 0
+    if (len > MSGQ_SEG_SIZE - sizeof(msg_hdr_t))
+        return NULL;
+    uint32_t size = msgq_record_size(len);
+    if (size > MSGQ_SEG_SIZE)
+        return NULL;
+
+    pthread_mutex_lock(&q->tail_lock);
+    msg_seg_t *seg = &q->segs[q->tail_seg];
+    uint32_t off = atomic_load_explicit(&seg->write_off, memory_order_relaxed);
+
+    if (off + size > MSGQ_SEG_SIZE) {
+        // Segment full: link a fresh one and drop the tail's reference to the old one
+        int idx = msgq_seg_alloc(q);
+        if (idx < 0) {
+            pthread_mutex_unlock(&q->tail_lock);
+            return NULL;
+        }
+        int old = q->tail_seg;
+        atomic_store_explicit(&seg->next, idx, memory_order_release);
+        msgq_seg_unref(q, old);
+        q->tail_seg = idx;
+        seg = &q->segs[idx];
+        off = 0;
+    }
+
+    msg_hdr_t *hdr = (msg_hdr_t *)(seg->data + off);
+    hdr->len = len;
+    atomic_store_explicit(&hdr->state, MSG_RESERVED, memory_order_relaxed);
+    atomic_fetch_add_explicit(&seg->refs, 1, memory_order_relaxed);
+    // Publish the header to consumers
+    atomic_store_explicit(&seg->write_off, off + size, memory_order_release);
+    pthread_mutex_unlock(&q->tail_lock);
+
+    return hdr + 1;
+}
+
+// Payload is written, hand it to consumers
+static inline void msgq_commit(msg_queue_t *q, void *payload) {
+    (void)q;
+    msg_hdr_t *hdr = (msg_hdr_t *)payload - 1;
+    atomic_store_explicit(&hdr->state, MSG_COMMITTED, memory_order_release);
+}
+
+// Next committed message, read in place. Returns NULL if there is none yet.
+static inline void *msgq_read(msg_queue_t *q, uint32_t *len) {
+    pthread_mutex_lock(&q->head_lock);
+
+    while (1) {
+        msg_seg_t *seg = &q->segs[q->head_seg];
+        uint32_t end = atomic_load_explicit(&seg->write_off, memory_order_acquire);
+
+        if (q->head_off < end) {
+            msg_hdr_t *hdr = (msg_hdr_t *)(seg->data + q->head_off);
+            if (atomic_load_explicit(&hdr->state, memory_order_acquire) != MSG_COMMITTED) {
+                pthread_mutex_unlock(&q->head_lock);
+                return NULL;
+            }
+            q->head_off += msgq_record_size(hdr->len);
+            pthread_mutex_unlock(&q->head_lock);
+            *len = hdr->len;
+            return hdr + 1;
+        }
+
+        int next = atomic_load_explicit(&seg->next, memory_order_acquire);
+        if (next < 0) {
+            pthread_mutex_unlock(&q->head_lock);
+            return NULL;
+        }
+        // Once next is set write_off is final, but it may have grown since we looked
+        if (q->head_off < atomic_load_explicit(&seg->write_off, memory_order_acquire))
+            continue;
+
+        int old = q->head_seg;
+        q->head_seg = next;
+        q->head_off = 0;
+        msgq_seg_unref(q, old);
+    }
+}
+
+// Done with the payload; its space can be reused once the whole segment is released
+static inline void msgq_release(msg_queue_t *q, void *payload) {
+    msgq_seg_unref(q, msgq_seg_of(q, payload));
+}
+
+static inline void msgq_destroy(msg_queue_t *q) {
+    free(q->segs);
+    pthread_mutex_destroy(&q->tail_lock);
+    pthread_mutex_destroy(&q->head_lock);
+    pthread_mutex_destroy(&q->free_lock);
+}
+
+#endif // __msg_queue_h__
@@ -0,0 +1,407 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Relaxed concurrent priority queue (MultiQueue, Rihani et al.)
+ * c*P binary heaps, each with its own lock. Insert goes to a random heap,
+ * delete-min samples two heaps and pops from the one with the smaller top.
+ * Compared against one exact heap behind a single lock.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "bench.h"
+
+#define MAX_THREADS 8
+#define MQ_C 2                   // Heaps per thread
+#define HEAP_INIT_CAP 1024
+#define PREFILL 100000
+#define OPS_PER_THREAD 200000
+#define RANK_KEYS 100000         // Keys used for the rank-error phase
+#define EMPTY_KEY INT_MAX
+
+// Binary min-heap of keys (not thread-safe by itself)
+typedef struct
+{
+    int *keys;
+    int size;
+    int cap;
+} heap_t;
+
+void heap_init(heap_t *h) {
+    h->keys = malloc(HEAP_INIT_CAP * sizeof(int));
+    h->size = 0;
+    h->cap = HEAP_INIT_CAP;
+}
+
+void heap_push(heap_t *h, int key) {
+    if (h->size == h->cap) {
+        h->cap *= 2;
+        h->keys = realloc(h->keys, h->cap * sizeof(int));
+    }
+    // Sift up
+    int i = h->size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (h->keys[parent] <= key)
+            break;
+        h->keys[i] = h->keys[parent];
+        i = parent;
+    }
+    h->keys[i] = key;
+}
+
+int heap_pop(heap_t *h) {
+    int min = h->keys[0];
+    int last = h->keys[--h->size];
+
+    // Sift down
+    int i = 0;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= h->size)
+            break;
+        if (child + 1 < h->size && h->keys[child + 1] < h->keys[child])
+            child++;
+        if (last <= h->keys[child])
+            break;
+        h->keys[i] = h->keys[child];
+        i = child;
+    }
+    if (h->size > 0)
+        h->keys[i] = last;
+    return min;
+}
+
+void heap_destroy(heap_t *h) {
+    free(h->keys);
+}
+
+// Rank-error log: each delete takes a ticket while holding the heap lock,
+// so ticket order is a valid linearization of the deletes
+atomic_int delete_ticket;
+int *delete_log;   // NULL when not measuring
+
+// Baseline: one exact heap, one lock
+typedef struct
+{
+    heap_t heap;
+    pthread_mutex_t lock;
+} locked_heap_t;
+
+void locked_heap_init(locked_heap_t *q) {
+    heap_init(&q->heap);
+    pthread_mutex_init(&q->lock, NULL);
+}
+
+void locked_heap_insert(locked_heap_t *q, int key) {
+    pthread_mutex_lock(&q->lock);
+    heap_push(&q->heap, key);
+    pthread_mutex_unlock(&q->lock);
+}
+
+int locked_heap_delete_min(locked_heap_t *q, int *key) {
+    pthread_mutex_lock(&q->lock);
+    if (q->heap.size == 0) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    *key = heap_pop(&q->heap);
+    if (delete_log != NULL) {
+        delete_log[atomic_fetch_add(&delete_ticket, 1)] = *key;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+void locked_heap_destroy(locked_heap_t *q) {
+    heap_destroy(&q->heap);
+    pthread_mutex_destroy(&q->lock);
+}
+
+// MultiQueue: each heap on its own cache line, with its top key cached
+// so delete-min can compare two heaps without taking either lock
+typedef struct
+{
+    _Alignas(64) heap_t heap;
+    pthread_mutex_t lock;
+    atomic_int top;    // EMPTY_KEY when the heap is empty
+} mq_heap_t;
+
+typedef struct
+{
+    mq_heap_t *heaps;
+    int num_heaps;
+} multiqueue_t;
+
+void mq_init(multiqueue_t *mq, int num_heaps) {
+    mq->num_heaps = num_heaps;
+    mq->heaps = aligned_alloc(64, num_heaps * sizeof(mq_heap_t));
+    for (int i = 0; i < num_heaps; i++) {
+        heap_init(&mq->heaps[i].heap);
+        pthread_mutex_init(&mq->heaps[i].lock, NULL);
+        atomic_init(&mq->heaps[i].top, EMPTY_KEY);
+    }
+}
+
+// Per-thread xorshift, rand() would serialize on its own lock
+static inline uint32_t next_rand(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *s = x;
+    return (uint32_t)(x >> 32);
+}
+
+void mq_insert(multiqueue_t *mq, int key, uint64_t *rng) {
+    while (1) {
+        mq_heap_t *h = &mq->heaps[next_rand(rng) % mq->num_heaps];
+        // Busy heap? Just pick another one
+        if (pthread_mutex_trylock(&h->lock) != 0)
+            continue;
+        heap_push(&h->heap, key);
+        atomic_store_explicit(&h->top, h->heap.keys[0], memory_order_relaxed);
+        pthread_mutex_unlock(&h->lock);
+        return;
+    }
+}
+
+int mq_delete_min(multiqueue_t *mq, int *key, uint64_t *rng) {
+    int misses = 0;
+
+    while (1) {
+        mq_heap_t *a = &mq->heaps[next_rand(rng) % mq->num_heaps];
+        mq_heap_t *b = &mq->heaps[next_rand(rng) % mq->num_heaps];
+        int top_a = atomic_load_explicit(&a->top, memory_order_relaxed);
+        int top_b = atomic_load_explicit(&b->top, memory_order_relaxed);
+        mq_heap_t *h = top_a <= top_b ? a : b;
+
+        if (top_a == EMPTY_KEY && top_b == EMPTY_KEY) {
+            // Looks empty: confirm with a full scan before giving up
+            if (++misses < mq->num_heaps)
+                continue;
+            int any = 0;
+            for (int i = 0; i < mq->num_heaps && !any; i++) {
+                any = atomic_load(&mq->heaps[i].top) != EMPTY_KEY;
+            }
+            if (!any)
+                return -1;
+            misses = 0;
+            continue;
+        }
+
+        if (pthread_mutex_trylock(&h->lock) != 0)
+            continue;
+        if (h->heap.size == 0) {
+            pthread_mutex_unlock(&h->lock);
+            continue;
+        }
+        *key = heap_pop(&h->heap);
+        atomic_store_explicit(&h->top, h->heap.size > 0 ? h->heap.keys[0] : EMPTY_KEY,
+                              memory_order_relaxed);
+        if (delete_log != NULL) {
+            delete_log[atomic_fetch_add(&delete_ticket, 1)] = *key;
+        }
+        pthread_mutex_unlock(&h->lock);
+        return 0;
+    }
+}
+
+void mq_destroy(multiqueue_t *mq) {
+    for (int i = 0; i < mq->num_heaps; i++) {
+        heap_destroy(&mq->heaps[i].heap);
+        pthread_mutex_destroy(&mq->heaps[i].lock);
+    }
+    free(mq->heaps);
+}
+
+// Benchmark plumbing
+typedef enum { PQ_LOCKED, PQ_MULTI } pq_kind_t;
+
+typedef struct
+{
+    pq_kind_t kind;
+    locked_heap_t locked;
+    multiqueue_t multi;
+} pq_t;
+
+void pq_insert(pq_t *pq, int key, uint64_t *rng) {
+    if (pq->kind == PQ_LOCKED)
+        locked_heap_insert(&pq->locked, key);
+    else
+        mq_insert(&pq->multi, key, rng);
+}
+
+int pq_delete_min(pq_t *pq, int *key, uint64_t *rng) {
+    if (pq->kind == PQ_LOCKED)
+        return locked_heap_delete_min(&pq->locked, key);
+    return mq_delete_min(&pq->multi, key, rng);
+}
+
+typedef struct
+{
+    pq_t *pq;
+    int thread_id;
+    int num_ops;
+    int mixed;   // 1: 50/50 insert/delete, 0: delete until empty
+} thread_arg_t;
+
+void* pq_worker(void* arg) {
+    thread_arg_t *targ = (thread_arg_t *)arg;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL * (targ->thread_id + 1);
+    int key;
+
+    if (targ->mixed) {
+        for (int i = 0; i < targ->num_ops; i++) {
+            if (next_rand(&rng) & 1)
+                pq_insert(targ->pq, next_rand(&rng) % (INT_MAX - 1), &rng);
+            else
+                pq_delete_min(targ->pq, &key, &rng);
+        }
+    } else {
+        while (pq_delete_min(targ->pq, &key, &rng) == 0) {
+        }
+    }
+    return NULL;
+}
+
+void pq_setup(pq_t *pq, pq_kind_t kind, int nthreads) {
+    pq->kind = kind;
+    if (kind == PQ_LOCKED)
+        locked_heap_init(&pq->locked);
+    else
+        mq_init(&pq->multi, MQ_C * nthreads);
+}
+
+void pq_teardown(pq_t *pq) {
+    if (pq->kind == PQ_LOCKED)
+        locked_heap_destroy(&pq->locked);
+    else
+        mq_destroy(&pq->multi);
+}
+
+void run_threads(pq_t *pq, int nthreads, int mixed) {
+    pthread_t threads[MAX_THREADS];
+    thread_arg_t args[MAX_THREADS];
+
+    for (int i = 0; i < nthreads; i++) {
+        args[i].pq = pq;
+        args[i].thread_id = i;
+        args[i].num_ops = OPS_PER_THREAD;
+        args[i].mixed = mixed;
+        pthread_create(&threads[i], NULL, pq_worker, &args[i]);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// Throughput of a 50/50 insert/delete-min mix on a prefilled queue
+double bench_throughput(pq_kind_t kind, int nthreads) {
+    pq_t pq;
+    pq_setup(&pq, kind, nthreads);
+    uint64_t rng = 42;
+    for (int i = 0; i < PREFILL; i++) {
+        pq_insert(&pq, next_rand(&rng) % (INT_MAX - 1), &rng);
+    }
+
+    thread_arg_t args[MAX_THREADS];
+    for (int i = 0; i < nthreads; i++) {
+        args[i].pq = &pq;
+        args[i].thread_id = i;
+        args[i].num_ops = OPS_PER_THREAD;
+        args[i].mixed = 1;
+    }
+    bench_t b = { .nthreads = nthreads, .worker = pq_worker, .args = args, .arg_size = sizeof(args[0]),
+                  .ops_per_thread = OPS_PER_THREAD };
+    bench_run(&b);
+
+    pq_teardown(&pq);
+    return b.ops_per_sec;
+}
+
+// Fenwick tree over key space, counts keys still in the queue
+void bit_add(int *bit, int n, int i, int delta) {
+    for (i++; i <= n; i += i & -i)
+        bit[i] += delta;
+}
+
+int bit_prefix(int *bit, int i) {   // Number of present keys < i
+    int sum = 0;
+    for (; i > 0; i -= i & -i)
+        sum += bit[i];
+    return sum;
+}
+
+// Rank error: fill with keys 0..RANK_KEYS-1, drain concurrently, and for
+// each delete (in ticket order) count the smaller keys that were still present
+void bench_rank_error(pq_kind_t kind, int nthreads, double *mean, int *max) {
+    pq_t pq;
+    pq_setup(&pq, kind, nthreads);
+
+    // Insert in shuffled order so heaps get a fair mix
+    int *keys = malloc(RANK_KEYS * sizeof(int));
+    uint64_t rng = 7;
+    for (int i = 0; i < RANK_KEYS; i++)
+        keys[i] = i;
+    for (int i = RANK_KEYS - 1; i > 0; i--) {
+        int j = next_rand(&rng) % (i + 1);
+        int tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    for (int i = 0; i < RANK_KEYS; i++)
+        pq_insert(&pq, keys[i], &rng);
+
+    delete_log = keys;   // Reuse the buffer for the log
+    atomic_store(&delete_ticket, 0);
+    run_threads(&pq, nthreads, 0);
+    delete_log = NULL;
+
+    int *bit = calloc(RANK_KEYS + 1, sizeof(int));
+    for (int i = 0; i < RANK_KEYS; i++)
+        bit_add(bit, RANK_KEYS, i, 1);
+
+    long total = 0;
+    *max = 0;
+    int deleted = atomic_load(&delete_ticket);
+    for (int i = 0; i < deleted; i++) {
+        int rank = bit_prefix(bit, keys[i]);
+        total += rank;
+        if (rank > *max)
+            *max = rank;
+        bit_add(bit, RANK_KEYS, keys[i], -1);
+    }
+    *mean = deleted > 0 ? (double)total / deleted : 0;
+
+    free(bit);
+    free(keys);
+    pq_teardown(&pq);
+}
+
+int main() {
+    printf("MultiQueue: c=%d heaps per thread, %d ops/thread, prefill %d\n\n",
+           MQ_C, OPS_PER_THREAD, PREFILL);
+    printf("%-8s %-10s %14s %12s %10s\n", "threads", "queue", "ops/sec", "mean rank", "max rank");
+
+    for (int nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+        for (int k = 0; k < 2; k++) {
+            pq_kind_t kind = k == 0 ? PQ_LOCKED : PQ_MULTI;
+            double ops = bench_throughput(kind, nthreads);
+            double mean_rank;
+            int max_rank;
+            bench_rank_error(kind, nthreads, &mean_rank, &max_rank);
+            printf("%-8d %-10s %14.0f %12.2f %10d\n", nthreads,
+                   kind == PQ_LOCKED ? "locked" : "multiq", ops, mean_rank, max_rank);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Ping-pong latency of the blocking primitives
+ * Two threads pass a token back and forth; each hop wakes a sleeping thread, so the
+ * round-trip time is two wakeups plus whatever the primitive adds around them.
+ *   sem_t            POSIX semaphores, one per direction
+ *   fsem             futex_sync.h semaphores, one per direction
+ *   cond             pthread_cond_t + mutex guarding a turn variable
+ *   eventcount       atomic turn variable, eventcount to sleep on
+ * The first table is the fast path: post then wait in one thread, nobody ever sleeps.
+ *
+ * usage: pingpong [round_trips]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "futex_sync.h"
+#include "timing.h"
+
+#define FAST_PATH_OPS 10000000
+
+static long round_trips = 100000;
+
+// sem_t
+static sem_t sem_ping, sem_pong;
+
+static void *sem_partner(void *arg) {
+    (void)arg;
+    for (long i = 0; i < round_trips; i++) {
+        sem_wait(&sem_ping);
+        sem_post(&sem_pong);
+    }
+    return NULL;
+}
+
+static void sem_initiator(void) {
+    for (long i = 0; i < round_trips; i++) {
+        sem_post(&sem_ping);
+        sem_wait(&sem_pong);
+    }
+}
+
+// fsem_t
+static fsem_t fsem_ping, fsem_pong;
+
+static void *fsem_partner(void *arg) {
+    (void)arg;
+    for (long i = 0; i < round_trips; i++) {
+        fsem_wait(&fsem_ping);
+        fsem_post(&fsem_pong);
+    }
+    return NULL;
+}
+
+static void fsem_initiator(void) {
+    for (long i = 0; i < round_trips; i++) {
+        fsem_post(&fsem_ping);
+        fsem_wait(&fsem_pong);
+    }
+}
+
+// pthread_cond_t: turn 0 = initiator's move, 1 = partner's
+static pthread_mutex_t cond_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int cond_turn;
+
+static void cond_hop(int mine) {
+    pthread_mutex_lock(&cond_lock);
+    while (cond_turn != mine)
+        pthread_cond_wait(&cond, &cond_lock);
+    cond_turn = !mine;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&cond_lock);
+}
+
+static void *cond_partner(void *arg) {
+    (void)arg;
+    for (long i = 0; i < round_trips; i++)
+        cond_hop(1);
+    return NULL;
+}
+
+static void cond_initiator(void) {
+    for (long i = 0; i < round_trips; i++)
+        cond_hop(0);
+}
+
+// eventcount
+static eventcount_t ec;
+static atomic_int ec_turn;
+
+static void ec_hop(int mine) {
+    while (atomic_load_explicit(&ec_turn, memory_order_acquire) != mine) {
+        unsigned key = ec_prepare_wait(&ec);
+        if (atomic_load_explicit(&ec_turn, memory_order_acquire) == mine) {
+            ec_cancel_wait(&ec);
+            break;
+        }
+        ec_commit_wait(&ec, key);
+    }
+    atomic_store_explicit(&ec_turn, !mine, memory_order_release);
+    ec_notify_one(&ec);
+}
+
+static void *ec_partner(void *arg) {
+    (void)arg;
+    for (long i = 0; i < round_trips; i++)
+        ec_hop(1);
+    return NULL;
+}
+
+static void ec_initiator(void) {
+    for (long i = 0; i < round_trips; i++)
+        ec_hop(0);
+}
+
+typedef struct
+{
+    const char *name;
+    void *(*partner)(void *);
+    void (*initiator)(void);
+} pingpong_t;
+
+static pingpong_t tests[] = {
+    { "sem_t", sem_partner, sem_initiator },
+    { "fsem", fsem_partner, fsem_initiator },
+    { "cond", cond_partner, cond_initiator },
+    { "eventcount", ec_partner, ec_initiator },
+};
+
+static void reset(void) {
+    sem_init(&sem_ping, 0, 0);
+    sem_init(&sem_pong, 0, 0);
+    fsem_init(&fsem_ping, 0);
+    fsem_init(&fsem_pong, 0);
+    cond_turn = 0;
+    ec_init(&ec);
+    atomic_init(&ec_turn, 0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1)
+        round_trips = atol(argv[1]);
+    if (round_trips <= 0) {
+        fprintf(stderr, "usage: pingpong [round_trips]\n");
+        exit(1);
+    }
+
+    // Fast path: nobody waits, so neither semaphore should enter the kernel
+    reset();
+    printf("Uncontended post + wait, %d pairs:\n", FAST_PATH_OPS);
+    double start = timing_now();
+    for (int i = 0; i < FAST_PATH_OPS; i++) {
+        sem_post(&sem_ping);
+        sem_wait(&sem_ping);
+    }
+    printf("  %-10s %8.1f ns\n", "sem_t", (timing_now() - start) * 1e9 / FAST_PATH_OPS);
+    start = timing_now();
+    for (int i = 0; i < FAST_PATH_OPS; i++) {
+        fsem_post(&fsem_ping);
+        fsem_wait(&fsem_ping);
+    }
+    printf("  %-10s %8.1f ns\n", "fsem", (timing_now() - start) * 1e9 / FAST_PATH_OPS);
+    start = timing_now();
+    for (int i = 0; i < FAST_PATH_OPS; i++)
+        ec_notify_one(&ec);
+    printf("  %-10s %8.1f ns (notify, no waiters)\n", "eventcount", (timing_now() - start) * 1e9 / FAST_PATH_OPS);
+
+    printf("Ping-pong, %ld round trips:\n", round_trips);
+    int num_tests = sizeof(tests) / sizeof(tests[0]);
+    for (int t = 0; t < num_tests; t++) {
+        pthread_t partner;
+        reset();
+        pthread_create(&partner, NULL, tests[t].partner, NULL);
+        start = timing_now();
+        tests[t].initiator();
+        double elapsed = timing_now() - start;
+        pthread_join(partner, NULL);
+        printf("  %-10s %8.0f ns per round trip\n", tests[t].name, elapsed * 1e9 / round_trips);
+    }
+
+    sem_destroy(&sem_ping);
+    sem_destroy(&sem_pong);
+    return 0;
+}
@@ -0,0 +1,261 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Thread placement from the sysfs CPU topology
+ * Picked with $OSTEP_PLACE (default compact), the same way in every benchmark:
+ *
+ *   compact    fill one socket first: SMT siblings of a core, then the next core
+ *   scatter    round-robin over sockets, physical cores before SMT siblings
+ *   cores      one thread per physical core (no SMT siblings), compact order
+ *   none       don't pin; the scheduler decides
+ *   0,2,8-11   explicit CPU list, thread i gets the i-th CPU
+ *
+ * Thread i runs on placement_cpu(p, i); more threads than CPUs wrap around.
+ * Bracket the setup of shared data structures with placement_pin_main() and
+ * placement_unpin_main(): main moves to thread 0's CPU, so first touch puts the pages
+ * on that node rather than wherever main happened to start. Unpin before creating
+ * threads that are not pinned themselves, or they inherit main's single CPU.
+ */
+
+#ifndef __placement_h__
+#define __placement_h__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE    // cpu_set_t, pthread_setaffinity_np; include this header before other system headers
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+typedef struct
+{
+    int cpu;
+    int package;
+    int core;       // core_id: unique only within a package
+    int core_idx;   // Dense index of the core within its package
+    int smt;        // 0 for the first hardware thread of a core, 1 for its sibling, ...
+    int node;
+} cpu_info_t;
+
+typedef struct
+{
+    char policy[64];
+    int pin;                    // 0 for "none"
+    int num_cpus;
+    int cpus[CPU_SETSIZE];      // Thread i -> cpus[i % num_cpus]
+    int nodes[CPU_SETSIZE];     // NUMA node of cpus[i]
+    cpu_set_t allowed;          // The process's own mask, for placement_unpin_main()
+} placement_t;
+
+static inline int placement_read_int(const char *fmt, int cpu, int fallback) {
+    char path[128];
+    snprintf(path, sizeof(path), fmt, cpu);
+    FILE *f = fopen(path, "r");
+    int v;
+    if (f == NULL)
+        return fallback;
+    if (fscanf(f, "%d", &v) != 1)
+        v = fallback;
+    fclose(f);
+    return v;
+}
+
+// Parse a cpulist ("0,2,8-11") into out[]; returns the count, -1 if malformed
+static inline int placement_parse_list(const char *s, int *out, int max) {
+    int n = 0;
+    while (*s != '\0' && *s != '\n') {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s || lo < 0)
+            return -1;
+        s = end;
+        if (*s == '-') {
+            hi = strtol(s + 1, &end, 10);
+            if (end == s + 1 || hi < lo)
+                return -1;
+            s = end;
+        }
+        for (long c = lo; c <= hi && n < max; c++)
+            out[n++] = (int)c;
+        if (*s == ',')
+            s++;
+        else if (*s != '\0' && *s != '\n')
+            return -1;
+    }
+    return n;
+}
+
+static inline int placement_cpu_node(int cpu) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *d = opendir(path);
+    int node = 0;
+    if (d == NULL)
+        return 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+            node = atoi(e->d_name + 4);
+            break;
+        }
+    }
+    closedir(d);
+    return node;
+}
+
+static inline void placement_read_cpu(cpu_info_t *ci, int cpu) {
+    ci->cpu = cpu;
+    ci->package = placement_read_int("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu, 0);
+    ci->core = placement_read_int("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu, cpu);
+    ci->node = placement_cpu_node(cpu);
+
+    // SMT rank: how many siblings have a lower CPU number
+    char path[128], buf[256];
+    int siblings[CPU_SETSIZE];
+    ci->smt = 0;
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    FILE *f = fopen(path, "r");
+    if (f != NULL) {
+        if (fgets(buf, sizeof(buf), f) != NULL) {
+            int n = placement_parse_list(buf, siblings, CPU_SETSIZE);
+            for (int i = 0; i < n; i++)
+                ci->smt += siblings[i] < cpu;
+        }
+        fclose(f);
+    }
+}
+
+static inline int placement_cmp_compact(const void *a, const void *b) {
+    const cpu_info_t *x = a, *y = b;
+    if (x->package != y->package)
+        return x->package - y->package;
+    if (x->core != y->core)
+        return x->core - y->core;
+    return x->smt - y->smt;
+}
+
+static inline int placement_cmp_scatter(const void *a, const void *b) {
+    const cpu_info_t *x = a, *y = b;
+    if (x->smt != y->smt)
+        return x->smt - y->smt;
+    if (x->core_idx != y->core_idx)
+        return x->core_idx - y->core_idx;
+    return x->package - y->package;
+}
+
+// Build the CPU order for a policy string; returns -1 (and leaves p unpinned) if it is unknown
+static inline int placement_init(placement_t *p, const char *policy) {
+    static cpu_info_t info[CPU_SETSIZE];
+    int n = 0;
+
+    snprintf(p->policy, sizeof(p->policy), "%s", policy);
+    p->pin = 0;
+    p->num_cpus = 0;
+    // Only CPUs we may run on (taskset, cgroups)
+    sched_getaffinity(0, sizeof(p->allowed), &p->allowed);
+    if (strcmp(policy, "none") == 0)
+        return 0;
+
+    for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &p->allowed))
+            placement_read_cpu(&info[n++], c);
+    }
+
+    if (strcmp(policy, "compact") == 0 || strcmp(policy, "cores") == 0 || strcmp(policy, "scatter") == 0) {
+        qsort(info, n, sizeof(cpu_info_t), placement_cmp_compact);
+        for (int i = 0; i < n; i++) {
+            int new_core = i == 0 || info[i].package != info[i - 1].package || info[i].core != info[i - 1].core;
+            int new_package = i == 0 || info[i].package != info[i - 1].package;
+            info[i].core_idx = new_package ? 0 : info[i - 1].core_idx + new_core;
+        }
+        if (strcmp(policy, "scatter") == 0)
+            qsort(info, n, sizeof(cpu_info_t), placement_cmp_scatter);
+        for (int i = 0; i < n; i++) {
+            if (strcmp(policy, "cores") == 0 && info[i].smt != 0)
+                continue;
+            p->nodes[p->num_cpus] = info[i].node;
+            p->cpus[p->num_cpus++] = info[i].cpu;
+        }
+    } else {
+        int list[CPU_SETSIZE];
+        int k = placement_parse_list(policy, list, CPU_SETSIZE);
+        if (k <= 0)
+            return -1;
+        for (int i = 0; i < k; i++) {
+            if (list[i] >= CPU_SETSIZE || !CPU_ISSET(list[i], &p->allowed)) {
+                fprintf(stderr, "placement: CPU %d is not available\n", list[i]);
+                return -1;
+            }
+            p->nodes[i] = placement_cpu_node(list[i]);
+            p->cpus[i] = list[i];
+        }
+        p->num_cpus = k;
+    }
+    p->pin = p->num_cpus > 0;
+    return 0;
+}
+
+// The process-wide placement from $OSTEP_PLACE, built on first use
+static placement_t placement_global;
+static pthread_once_t placement_once = PTHREAD_ONCE_INIT;
+
+static inline void placement_global_init(void) {
+    const char *policy = getenv("OSTEP_PLACE");
+    if (policy == NULL || *policy == '\0')
+        policy = "compact";
+    if (placement_init(&placement_global, policy) != 0) {
+        fprintf(stderr, "OSTEP_PLACE=%s: expected compact, scatter, cores, none or a CPU list; not pinning\n", policy);
+        placement_init(&placement_global, "none");
+    }
+}
+
+static inline placement_t *placement_default(void) {
+    pthread_once(&placement_once, placement_global_init);
+    return &placement_global;
+}
+
+static inline int placement_cpu(placement_t *p, int tid) {
+    return p->pin ? p->cpus[tid % p->num_cpus] : -1;
+}
+
+static inline int placement_node(placement_t *p, int tid) {
+    return p->pin ? p->nodes[tid % p->num_cpus] : -1;
+}
+
+// Pin the calling thread to thread tid's CPU
+static inline void placement_pin_self(placement_t *p, int tid) {
+    if (!p->pin)
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(placement_cpu(p, tid), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Main thread: move next to thread 0 before allocating shared data (first touch)
+static inline void placement_pin_main(void) {
+    placement_pin_self(placement_default(), 0);
+}
+
+// Back to every CPU the process started with
+static inline void placement_unpin_main(void) {
+    placement_t *p = placement_default();
+    pthread_setaffinity_np(pthread_self(), sizeof(p->allowed), &p->allowed);
+}
+
+// One line for the top of a benchmark's output
+static inline void placement_print(placement_t *p, FILE *out) {
+    fprintf(out, "Placement: %s", p->policy);
+    if (p->pin) {
+        fprintf(out, " (cpus");
+        for (int i = 0; i < p->num_cpus && i < 16; i++)
+            fprintf(out, "%s%d", i ? "," : " ", p->cpus[i]);
+        fprintf(out, "%s; thread 0 on node %d)", p->num_cpus > 16 ? ",..." : "", p->nodes[0]);
+    }
+    fprintf(out, "\n");
+}
+
+#endif // __placement_h__
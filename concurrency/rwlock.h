@@ -0,0 +1,168 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Reader-writer locks, picked at compile time like locks.h:
+ *   gcc -DUSE_RWLOCK -DRWLOCK_IMPL=posix concurrent_hash.c
+ *
+ *   percpu   writer-preferring big-reader lock (default). A reader only bumps the
+ *            count on its own CPU's cache line, so readers on different cores never
+ *            share a line. A writer raises a flag, then waits for every per-CPU count
+ *            to drain; readers that see the flag back off and sleep until it drops.
+ *   posix    pthread_rwlock_t, the baseline
+ *
+ * rwlock_read_lock() returns a token that must be passed to rwlock_read_unlock():
+ * a reader may migrate while holding the lock, and has to decrement the slot it bumped.
+ *
+ * ds_lock_t at the bottom is what the hash and list use: the RW lock with -DUSE_RWLOCK,
+ * otherwise the exclusive lock_t from locks.h (reads just take it).
+ */
+
+#ifndef __rwlock_h__
+#define __rwlock_h__
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE    // sched_getcpu; include this header before other system headers
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include "futex.h"
+#include "locks.h"
+
+#ifndef RWLOCK_IMPL
+#define RWLOCK_IMPL percpu
+#endif
+
+#define RW_SPIN_TRIES 100
+
+// percpu
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_long count;
+} rw_slot_t;
+
+typedef struct
+{
+    _Alignas(LOCK_CACHE_LINE) atomic_uint writer;    // 1 while a writer holds or wants the lock
+    atomic_uint sleepers;                            // Readers blocked on writer
+    pthread_mutex_t wlock;                           // Writers queue here
+    rw_slot_t *readers;
+    int num_slots;
+} percpu_rwlock_t;
+
+static inline void percpu_init(percpu_rwlock_t *l) {
+    atomic_init(&l->writer, 0);
+    atomic_init(&l->sleepers, 0);
+    pthread_mutex_init(&l->wlock, NULL);
+    l->num_slots = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (l->num_slots < 1)
+        l->num_slots = 1;
+    l->readers = aligned_alloc(LOCK_CACHE_LINE, l->num_slots * sizeof(rw_slot_t));
+    for (int i = 0; i < l->num_slots; i++)
+        atomic_init(&l->readers[i].count, 0);
+}
+
+static inline int percpu_read_lock(percpu_rwlock_t *l) {
+    int cpu = sched_getcpu();
+    int slot = cpu >= 0 && cpu < l->num_slots ? cpu : 0;
+
+    while (1) {
+        // Announce, then look for a writer; the writer does the mirror image
+        // (flag, then look at counts), so one of us always sees the other
+        atomic_fetch_add_explicit(&l->readers[slot].count, 1, memory_order_seq_cst);
+        if (atomic_load_explicit(&l->writer, memory_order_seq_cst) == 0)
+            return slot;
+        atomic_fetch_sub_explicit(&l->readers[slot].count, 1, memory_order_release);
+
+        // Writer preferred: step aside until it is done
+        for (int i = 0; i < RW_SPIN_TRIES && atomic_load_explicit(&l->writer, memory_order_relaxed); i++)
+            cpu_relax();
+        atomic_fetch_add(&l->sleepers, 1);
+        while (atomic_load(&l->writer))
+            futex_wait(&l->writer, 1);
+        atomic_fetch_sub(&l->sleepers, 1);
+    }
+}
+
+static inline void percpu_read_unlock(percpu_rwlock_t *l, int slot) {
+    atomic_fetch_sub_explicit(&l->readers[slot].count, 1, memory_order_release);
+}
+
+static inline void percpu_write_lock(percpu_rwlock_t *l) {
+    pthread_mutex_lock(&l->wlock);
+    atomic_store_explicit(&l->writer, 1, memory_order_seq_cst);
+
+    // Wait for readers already inside to leave. seq_cst, not acquire: the flag store
+    // and these loads are the writer's half of the store-buffering pair with
+    // percpu_read_lock, and an acquire load may still read a count from before the flag
+    for (int i = 0; i < l->num_slots; i++) {
+        int spins = 0;
+        while (atomic_load_explicit(&l->readers[i].count, memory_order_seq_cst) != 0)
+            lock_spin(&spins);
+    }
+}
+
+static inline void percpu_write_unlock(percpu_rwlock_t *l) {
+    atomic_store_explicit(&l->writer, 0, memory_order_seq_cst);
+    if (atomic_load(&l->sleepers) > 0)
+        futex_wake(&l->writer, INT_MAX);
+    pthread_mutex_unlock(&l->wlock);
+}
+
+static inline void percpu_destroy(percpu_rwlock_t *l) {
+    pthread_mutex_destroy(&l->wlock);
+    free(l->readers);
+}
+
+// posix
+typedef struct
+{
+    pthread_rwlock_t rw;
+} posix_rwlock_t;
+
+static inline void posix_init(posix_rwlock_t *l) { pthread_rwlock_init(&l->rw, NULL); }
+static inline int posix_read_lock(posix_rwlock_t *l) { pthread_rwlock_rdlock(&l->rw); return 0; }
+static inline void posix_read_unlock(posix_rwlock_t *l, int token) { (void)token; pthread_rwlock_unlock(&l->rw); }
+static inline void posix_write_lock(posix_rwlock_t *l) { pthread_rwlock_wrlock(&l->rw); }
+static inline void posix_write_unlock(posix_rwlock_t *l) { pthread_rwlock_unlock(&l->rw); }
+static inline void posix_destroy(posix_rwlock_t *l) { pthread_rwlock_destroy(&l->rw); }
+
+// Compile-time selection
+#define RWLOCK_NAME LOCK_STR(RWLOCK_IMPL)
+
+typedef LOCK_CAT(RWLOCK_IMPL, _rwlock_t) rwlock_t;
+
+static inline void rwlock_init(rwlock_t *l) { LOCK_CAT(RWLOCK_IMPL, _init)(l); }
+static inline int rwlock_read_lock(rwlock_t *l) { return LOCK_CAT(RWLOCK_IMPL, _read_lock)(l); }
+static inline void rwlock_read_unlock(rwlock_t *l, int token) { LOCK_CAT(RWLOCK_IMPL, _read_unlock)(l, token); }
+static inline void rwlock_write_lock(rwlock_t *l) { LOCK_CAT(RWLOCK_IMPL, _write_lock)(l); }
+static inline void rwlock_write_unlock(rwlock_t *l) { LOCK_CAT(RWLOCK_IMPL, _write_unlock)(l); }
+static inline void rwlock_destroy(rwlock_t *l) { LOCK_CAT(RWLOCK_IMPL, _destroy)(l); }
+
+// Data-structure lock
+#ifdef USE_RWLOCK
+typedef rwlock_t ds_lock_t;
+#define DS_LOCK_NAME "rw_" RWLOCK_NAME
+
+static inline void ds_lock_init(ds_lock_t *l) { rwlock_init(l); }
+static inline int ds_read_lock(ds_lock_t *l) { return rwlock_read_lock(l); }
+static inline void ds_read_unlock(ds_lock_t *l, int token) { rwlock_read_unlock(l, token); }
+static inline void ds_write_lock(ds_lock_t *l) { rwlock_write_lock(l); }
+static inline void ds_write_unlock(ds_lock_t *l) { rwlock_write_unlock(l); }
+static inline void ds_lock_destroy(ds_lock_t *l) { rwlock_destroy(l); }
+#else
+typedef lock_t ds_lock_t;
+#define DS_LOCK_NAME LOCK_NAME
+
+static inline void ds_lock_init(ds_lock_t *l) { lock_init(l); }
+static inline int ds_read_lock(ds_lock_t *l) { lock_acquire(l); return 0; }
+static inline void ds_read_unlock(ds_lock_t *l, int token) { (void)token; lock_release(l); }
+static inline void ds_write_lock(ds_lock_t *l) { lock_acquire(l); }
+static inline void ds_write_unlock(ds_lock_t *l) { lock_release(l); }
+static inline void ds_lock_destroy(ds_lock_t *l) { lock_destroy(l); }
+#endif
+
+#endif // __rwlock_h__
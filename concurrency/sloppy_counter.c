@@ -1,32 +1,60 @@
 /**
  * OSTEP - Concurrency
- * 
+ *
  * Sloppy counter for better scalability
+ * One local count per CPU (found with sched_getcpu), each on its own cache line.
+ * Updates are an uncontended atomic add on the current CPU's line, no mutex.
+ *
+ * Variant: thread-local sloppy counter. Each thread accumulates in its own handle
+ * and flushes with one fetch_add when it reaches S (or FLUSH_NS has passed while it
+ * keeps updating), so a read of the global is never off by more than threads * (S - 1).
+ * Handles are registered with the counter, so an exact read can also fold in
+ * counts left behind by threads that went idle.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <assert.h>
 #include <time.h>
 #include <unistd.h>
+#include "trace.h"
+#include "bench.h"
+#include "timing.h"
 
-#define NUM_CPUS 4
 #define NUM_THREADS 4
 // #define INCREMENTS_PER_THREAD 1000007
 #define INCREMENTS_PER_THREAD 100000
+#define CACHE_LINE_SIZE 64
+#define FLUSH_NS 1000000        // Time bound for the thread-local variant (1ms)
+#define FLUSH_CHECK_EVERY 64    // Look at the clock only every N updates
+#define TLS_MAX_THREADS 256
+#define TLS_READ_RETRIES 16
+
+// Trace events (OSTEP_TRACE=<file> to save them)
+enum { EV_TRANSFER, EV_WORKER };
+const char *const trace_names[] = { "sloppy_transfer", "worker" };
+
+// Padded so two CPUs never write the same cache line
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) atomic_long count;
+} percpu_slot_t;
 
 // Sloppy counter structure
-typedef struct  
+typedef struct
 {
-    int global;  // Global count
-    pthread_mutex_t glock;   // Global lock
-    int local[NUM_CPUS];   // Per-CPU local counts
-    pthread_mutex_t llock[NUM_CPUS];    // Per-CPU locks
+    _Alignas(CACHE_LINE_SIZE) atomic_long global;  // Global count
+    percpu_slot_t *local;   // Per-CPU local counts
+    int num_cpus;
     int threshold;    // Update threshold (S value)
 } sloppy_counter_t;
 
 // Thread arg structure
-typedef struct  
+typedef struct
 {
     sloppy_counter_t *counter;
     int thread_id;
@@ -36,89 +64,256 @@ typedef struct
 // Init
 void sloppy_init(sloppy_counter_t *c, int threshold) {
     c->threshold = threshold;
-    c->global = 0;
-    pthread_mutex_init(&c->glock, NULL);
+    atomic_init(&c->global, 0);
 
-    for (int i = 0; i < NUM_CPUS; i++) {
-        c->local[i] = 0;
-        pthread_mutex_init(&c->llock[i], NULL);
+    // Size by configured CPUs: sched_getcpu() can return any of those ids
+    c->num_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+    if (c->num_cpus < 1)
+        c->num_cpus = 1;
+    c->local = aligned_alloc(CACHE_LINE_SIZE, c->num_cpus * sizeof(percpu_slot_t));
+
+    for (int i = 0; i < c->num_cpus; i++) {
+        atomic_init(&c->local[i].count, 0);
     }
 }
 
+// CPU we are running on right now. With glibc >= 2.35 this reads the rseq
+// area the kernel keeps up to date, so there is no syscall.
+static inline int current_cpu(sloppy_counter_t *c) {
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < c->num_cpus ? cpu : 0;
+}
+
 // Update
-void sloppy_update(sloppy_counter_t *c, int cpu_id, int amt) {
-    // Lock the local counter for this CPU
-    pthread_mutex_lock(&c->llock[cpu_id]);
-    c->local[cpu_id] += amt;
+void sloppy_update(sloppy_counter_t *c, int amt) {
+    // We may migrate right after sched_getcpu(), so the add is still atomic,
+    // but it is almost always uncontended and the line stays in our cache
+    int cpu = current_cpu(c);
+    percpu_slot_t *slot = &c->local[cpu];
+    long val = atomic_fetch_add_explicit(&slot->count, amt, memory_order_relaxed) + amt;
 
     // If local counter exceed the threshold, transfer to global
-    if (c->local[cpu_id] >= c->threshold) {
-        pthread_mutex_lock(&c->glock);
-        c->global += c->local[cpu_id];
-        pthread_mutex_unlock(&c->glock);
-
-        // Remember to reset the local counter
-        c->local[cpu_id] = 0;
-        printf("[CPU %d] transferred to global (threshold %d reached)\n", cpu_id, c->threshold);
+    if (val >= c->threshold) {
+        // Take whatever is there (another thread may have added in the meantime)
+        long moved = atomic_exchange_explicit(&slot->count, 0, memory_order_relaxed);
+        if (moved != 0) {
+            atomic_fetch_add_explicit(&c->global, moved, memory_order_relaxed);
+            TRACE(EV_TRANSFER, cpu, moved);   // printf here would measure stdio, not the counter
+        }
     }
-
-    pthread_mutex_unlock(&c->llock[cpu_id]);
 }
 
 // Get rough value (only read global counter)
-int sloppy_get_approx(sloppy_counter_t *c) {
-    pthread_mutex_lock(&c->glock);
-    int val = c->global;
-    pthread_mutex_unlock(&c->glock);
-    return val;
+long sloppy_get_approx(sloppy_counter_t *c) {
+    return atomic_load_explicit(&c->global, memory_order_relaxed);
 }
 
-// Get precise value (lock everything)
-int sloppy_get_precise(sloppy_counter_t *c) {
-    pthread_mutex_lock(&c->glock);
-    int total = c->global;
+// Get precise value (global plus every local); exact once updaters are quiet
+long sloppy_get_precise(sloppy_counter_t *c) {
+    long total = atomic_load(&c->global);
 
-    for (int i = 0; i < NUM_CPUS; i++) {
-        pthread_mutex_lock(&c->llock[i]);
-        total += c->local[i];
-        pthread_mutex_unlock(&c->llock[i]);
+    for (int i = 0; i < c->num_cpus; i++) {
+        total += atomic_load(&c->local[i].count);
     }
 
-    pthread_mutex_unlock(&c->glock);
     return total;
 }
 
+// Thread-local variant: each thread's pending count lives in its handle,
+// which is registered so a reader can fold it in
+typedef struct tls_handle tls_handle_t;
+
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) atomic_long global;
+    int threshold;
+    pthread_mutex_t reg_lock;    // Register/unregister and exact reads (cold paths)
+    tls_handle_t *handles[TLS_MAX_THREADS];
+    atomic_int num_handles;      // Written under reg_lock; the cheap read loads it lock-free
+} tls_counter_t;
+
+// Per-thread part; pending and seq are written only by the owner thread
+struct tls_handle
+{
+    _Alignas(CACHE_LINE_SIZE) atomic_long pending;
+    atomic_uint seq;    // Odd while a flush is moving pending into global
+    tls_counter_t *counter;
+    unsigned updates;
+    long last_flush_ns;
+    int slot;
+};
+
+static inline long coarse_ns() {
+    // Coarse clock is a plain vDSO read, good enough for a millisecond bound
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void tls_counter_init(tls_counter_t *c, int threshold) {
+    atomic_init(&c->global, 0);
+    c->threshold = threshold;
+    pthread_mutex_init(&c->reg_lock, NULL);
+    atomic_init(&c->num_handles, 0);
+}
+
+void tls_counter_register(tls_counter_t *c, tls_handle_t *h) {
+    h->counter = c;
+    atomic_init(&h->pending, 0);
+    atomic_init(&h->seq, 0);
+    h->updates = 0;
+    h->last_flush_ns = coarse_ns();
+
+    pthread_mutex_lock(&c->reg_lock);
+    int n = atomic_load_explicit(&c->num_handles, memory_order_relaxed);
+    assert(n < TLS_MAX_THREADS);
+    h->slot = n;
+    c->handles[n] = h;
+    atomic_store_explicit(&c->num_handles, n + 1, memory_order_release);
+    pthread_mutex_unlock(&c->reg_lock);
+}
+
+void tls_counter_flush(tls_handle_t *h) {
+    long p = atomic_load_explicit(&h->pending, memory_order_relaxed);
+    if (p != 0) {
+        // seqlock write side, so an exact read never counts p twice or not at all
+        unsigned s = atomic_load_explicit(&h->seq, memory_order_relaxed);
+        atomic_store_explicit(&h->seq, s + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        atomic_fetch_add_explicit(&h->counter->global, p, memory_order_relaxed);
+        atomic_store_explicit(&h->pending, 0, memory_order_relaxed);
+        atomic_store_explicit(&h->seq, s + 2, memory_order_release);
+    }
+    h->last_flush_ns = coarse_ns();
+}
+
+// Flush what is left and stop counting toward the error bound
+void tls_counter_unregister(tls_handle_t *h) {
+    tls_counter_t *c = h->counter;
+    tls_counter_flush(h);
+
+    // Release: a cheap read that sees the smaller count also sees our flush in global
+    pthread_mutex_lock(&c->reg_lock);
+    int n = atomic_load_explicit(&c->num_handles, memory_order_relaxed) - 1;
+    atomic_store_explicit(&c->num_handles, n, memory_order_release);
+    tls_handle_t *last = c->handles[n];
+    c->handles[h->slot] = last;
+    last->slot = h->slot;
+    pthread_mutex_unlock(&c->reg_lock);
+}
+
+static inline void tls_counter_update(tls_handle_t *h, long amt) {
+    // Only we write pending: load + store, no lock prefix
+    long p = atomic_load_explicit(&h->pending, memory_order_relaxed) + amt;
+    atomic_store_explicit(&h->pending, p, memory_order_relaxed);
+    if (p >= h->counter->threshold || p <= -h->counter->threshold) {
+        tls_counter_flush(h);
+    } else if (++h->updates % FLUSH_CHECK_EVERY == 0 && coarse_ns() - h->last_flush_ns >= FLUSH_NS) {
+        tls_counter_flush(h);    // Slow thread: keep the cheap read from lagging
+    }
+}
+
+// Cheap read: one load (two with error), no lock. Every thread keeps |pending| < S
+// between updates, so the true value is within +-error of what we return. The handle
+// count is loaded first: an unregister that drops it has already flushed into global,
+// and one we miss only makes the bound larger. A thread that stops updating keeps its
+// pending count until it unregisters; use the exact read for that.
+long tls_counter_read(tls_counter_t *c, long *error) {
+    int n = atomic_load_explicit(&c->num_handles, memory_order_acquire);
+    long val = atomic_load_explicit(&c->global, memory_order_relaxed);
+    if (error != NULL)
+        *error = (long)n * (c->threshold - 1);
+    return val;
+}
+
+// Exact read: global plus every registered pending count, retried until no
+// flush ran in between (seqlock read side). Idle threads' counts are included,
+// so this never lags in time. If flushes keep racing with us, give up after
+// a few tries and report the bound instead of 0 in *error.
+long tls_counter_read_exact(tls_counter_t *c, long *error) {
+    unsigned seqs[TLS_MAX_THREADS];
+    long val = 0;
+
+    pthread_mutex_lock(&c->reg_lock);
+    for (int attempt = 0; attempt < TLS_READ_RETRIES; attempt++) {
+        int n = atomic_load_explicit(&c->num_handles, memory_order_relaxed), busy = 0;
+        for (int i = 0; i < n && !busy; i++) {
+            seqs[i] = atomic_load_explicit(&c->handles[i]->seq, memory_order_acquire);
+            busy = seqs[i] & 1;
+        }
+        if (busy)
+            continue;
+
+        val = atomic_load_explicit(&c->global, memory_order_relaxed);
+        for (int i = 0; i < n; i++)
+            val += atomic_load_explicit(&c->handles[i]->pending, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+
+        int changed = 0;
+        for (int i = 0; i < n && !changed; i++)
+            changed = atomic_load_explicit(&c->handles[i]->seq, memory_order_relaxed) != seqs[i];
+        if (!changed) {
+            pthread_mutex_unlock(&c->reg_lock);
+            if (error != NULL)
+                *error = 0;
+            return val;
+        }
+    }
+    if (error != NULL)
+        *error = (long)atomic_load_explicit(&c->num_handles, memory_order_relaxed) * c->threshold;
+    pthread_mutex_unlock(&c->reg_lock);
+    return val;
+}
+
+void tls_counter_destroy(tls_counter_t *c) {
+    pthread_mutex_destroy(&c->reg_lock);
+}
+
 // Sloppy counter
 void* sloppy_increment(void* arg) {
     thread_arg_t *targ = (thread_arg_t *)arg;
-    int cpu_id = targ->thread_id % NUM_CPUS;
 
+    trace_thread_init();    // Ring set up outside the measured loop
+    TRACE_BEGIN_EV(EV_WORKER, targ->thread_id);
     for (int i = 0; i < targ->num_increments; i++) {
-        sloppy_update(targ->counter, cpu_id, 1);
+        sloppy_update(targ->counter, 1);
     }
+    TRACE_END_EV(EV_WORKER, targ->thread_id);
 
     return NULL;
 }
 
-// Clean up
-void sloppy_destroy(sloppy_counter_t *c) {
-    pthread_mutex_destroy(&c->glock);
-    for (int i = 0; i < NUM_CPUS; i++) {
-        pthread_mutex_destroy(&c->llock[i]);
+typedef struct
+{
+    tls_counter_t *counter;
+    int num_increments;
+} tls_arg_t;
+
+void* tls_increment(void* arg) {
+    tls_arg_t *targ = (tls_arg_t *)arg;
+    tls_handle_t h;
+
+    tls_counter_register(targ->counter, &h);
+    for (int i = 0; i < targ->num_increments; i++) {
+        tls_counter_update(&h, 1);
     }
+    tls_counter_unregister(&h);
+
+    return NULL;
 }
 
-// Get the time
-double get_time() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+// Clean up
+void sloppy_destroy(sloppy_counter_t *c) {
+    free(c->local);
 }
 
 int main() {
     int thresholds[] = {1, 10, 100, 1000, 10000};
     int num_tests = sizeof(thresholds) / sizeof(thresholds[0]);
 
+    printf("Online CPUs: %ld, configured: %ld\n\n",
+           sysconf(_SC_NPROCESSORS_ONLN), sysconf(_SC_NPROCESSORS_CONF));
+
     for (int t = 0; t < num_tests; t++) {
         int S = thresholds[t];
         printf("Testing with threshold S = %d:\n", S);
@@ -126,41 +321,89 @@ int main() {
         sloppy_counter_t counter;
         sloppy_init(&counter, S);
 
-        pthread_t threads[NUM_THREADS];
         thread_arg_t args[NUM_THREADS];
-
-        double start_time = get_time();
-
-        // Create threads
         for (int i = 0; i < NUM_THREADS; i++) {
             args[i].counter = &counter;
             args[i].thread_id = i;
             args[i].num_increments = INCREMENTS_PER_THREAD;
-            pthread_create(&threads[i], NULL, sloppy_increment, &args[i]);
         }
 
-        for (int i = 0; i < NUM_THREADS; i++) {
-            pthread_join(threads[i], NULL);
-        }
-
-        double end_time = get_time();
+        bench_t b = { .nthreads = NUM_THREADS, .worker = sloppy_increment, .args = args,
+                      .arg_size = sizeof(args[0]), .ops_per_thread = INCREMENTS_PER_THREAD };
+        bench_run(&b);
 
         // Get results
-        int approx_val = sloppy_get_approx(&counter);
-        int precise_val = sloppy_get_precise(&counter);
+        long approx_val = sloppy_get_approx(&counter);
+        long precise_val = sloppy_get_precise(&counter);
 
-        printf("Time: %.4f seconds\n", end_time - start_time);
-        printf("Approx val (global only): %d\n", approx_val);
-        printf("Precise val (all): %d\n", precise_val);
+        printf("Time: %.4f seconds\n", b.seconds);
+        bench_report(&b, "sloppy");
+        printf("Approx val (global only): %ld\n", approx_val);
+        printf("Precise val (all): %ld\n", precise_val);
         printf("Local values: [");
-        for (int i = 0; i < NUM_CPUS; i++) {
-            printf("%d", counter.local[i]);
-            if (i < NUM_CPUS - 1) printf(", ");
+        for (int i = 0; i < counter.num_cpus; i++) {
+            printf("%ld", atomic_load(&counter.local[i].count));
+            if (i < counter.num_cpus - 1) printf(", ");
         }
         printf("]\n\n");
 
         sloppy_destroy(&counter);
     }
 
+    printf("-------------------------------------\n");
+    printf("Thread-local variant (flush at S or every %d us)\n\n", FLUSH_NS / 1000);
+
+    for (int t = 0; t < num_tests; t++) {
+        int S = thresholds[t];
+        printf("Testing with threshold S = %d:\n", S);
+
+        tls_counter_t counter;
+        tls_counter_init(&counter, S);
+
+        pthread_t threads[NUM_THREADS];
+        tls_arg_t args[NUM_THREADS];
+
+        double start_time = timing_now();
+        for (int i = 0; i < NUM_THREADS; i++) {
+            args[i].counter = &counter;
+            args[i].num_increments = INCREMENTS_PER_THREAD;
+            pthread_create(&threads[i], NULL, tls_increment, &args[i]);
+        }
+
+        // Monitor: reads while the threads run, with their bounds
+        long error;
+        long mid_val = tls_counter_read(&counter, &error);
+        printf("Mid-run read: %ld (+- %ld)\n", mid_val, error);
+        mid_val = tls_counter_read_exact(&counter, &error);
+        printf("Mid-run exact read: %ld (+- %ld)\n", mid_val, error);
+
+        for (int i = 0; i < NUM_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        double end_time = timing_now();
+
+        long val = tls_counter_read(&counter, &error);
+        printf("Time: %.4f seconds\n", end_time - start_time);
+        printf("Final read: %ld (+- %ld)\n\n", val, error);
+        tls_counter_destroy(&counter);
+    }
+
+    // A thread that goes quiet below S: only the exact read sees its count
+    tls_counter_t idle;
+    tls_handle_t h;
+    tls_counter_init(&idle, 1000);
+    tls_counter_register(&idle, &h);
+    for (int i = 0; i < 500; i++) {
+        tls_counter_update(&h, 1);
+    }
+    long error;
+    long val = tls_counter_read(&idle, &error);
+    printf("Idle thread, 500 updates below S = 1000: read %ld (+- %ld)", val, error);
+    val = tls_counter_read_exact(&idle, &error);
+    printf(", exact read %ld (+- %ld)\n", val, error);
+    tls_counter_unregister(&h);
+    tls_counter_destroy(&idle);
+
+    trace_write_env(trace_names, sizeof(trace_names) / sizeof(trace_names[0]));
     return 0;
 }
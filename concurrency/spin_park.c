@@ -0,0 +1,171 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Spin or park? Sweeps the critical-section length and runs the same workload under
+ * pthread_mutex_t, the TTAS spinlock, the futex lock and the adaptive lock from locks.h.
+ * Each thread loops: lock, busy-work for cs_ns, unlock, busy-work for OUTSIDE_NS.
+ * Short sections favour spinning (a park/wake round trip costs microseconds); long ones
+ * favour parking (spinners burn the CPU the owner needs). The adaptive lock should track
+ * the better of the two. Context switches per op show who went to the kernel.
+ *
+ * usage: spin_park [threads]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "locks.h"
+#include "timing.h"
+
+#define MAX_THREADS 64
+#define RUN_MS 200
+#define OUTSIDE_NS 100
+
+static const int cs_lengths[] = { 0, 50, 200, 1000, 5000, 20000, 100000 };
+
+typedef struct
+{
+    const char *name;
+    size_t size;
+    void (*init)(void *);
+    void (*acquire)(void *);
+    void (*release)(void *);
+    void (*destroy)(void *);
+} lock_ops_t;
+
+// Adapters so one table can hold every lock type behind void *
+#define LOCK_OPS(impl) \
+    static void impl##_op_init(void *l) { impl##_init((impl##_lock_t *)l); } \
+    static void impl##_op_acquire(void *l) { impl##_acquire((impl##_lock_t *)l); } \
+    static void impl##_op_release(void *l) { impl##_release((impl##_lock_t *)l); } \
+    static void impl##_op_destroy(void *l) { impl##_destroy((impl##_lock_t *)l); }
+#define LOCK_ENTRY(impl) \
+    { #impl, sizeof(impl##_lock_t), impl##_op_init, impl##_op_acquire, impl##_op_release, impl##_op_destroy }
+
+LOCK_OPS(mutex)
+LOCK_OPS(ttas)
+LOCK_OPS(futex)
+LOCK_OPS(adaptive)
+
+static lock_ops_t locks[] = {
+    LOCK_ENTRY(mutex),
+    LOCK_ENTRY(ttas),
+    LOCK_ENTRY(futex),
+    LOCK_ENTRY(adaptive),
+};
+
+typedef struct
+{
+    lock_ops_t *ops;
+    void *lock;
+    long cs_iters;
+    long outside_iters;
+    atomic_int stop;
+    long shared;    // Written inside the critical section
+} bench_t;
+
+static double iters_per_ns;
+
+static void busy(long iters) {
+    for (volatile long i = 0; i < iters; i++)
+        ;
+}
+
+// How many busy() iterations fit in a nanosecond on this machine
+static void calibrate(void) {
+    long iters = 1000;
+    double elapsed;
+    do {
+        iters *= 2;
+        double start = timing_now();
+        busy(iters);
+        elapsed = timing_now() - start;
+    } while (elapsed < 0.05);
+    iters_per_ns = iters / (elapsed * 1e9);
+}
+
+static void *worker(void *arg) {
+    bench_t *b = (bench_t *)arg;
+    long ops = 0;
+    while (!atomic_load_explicit(&b->stop, memory_order_relaxed)) {
+        b->ops->acquire(b->lock);
+        b->shared++;
+        busy(b->cs_iters);
+        b->ops->release(b->lock);
+        busy(b->outside_iters);
+        ops++;
+    }
+    return (void *)ops;
+}
+
+static long context_switches(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void run_cell(lock_ops_t *ops, int cs_ns, int nthreads) {
+    pthread_t threads[MAX_THREADS];
+    bench_t b;
+    b.ops = ops;
+    b.lock = aligned_alloc(LOCK_CACHE_LINE, (ops->size + LOCK_CACHE_LINE - 1) / LOCK_CACHE_LINE * LOCK_CACHE_LINE);
+    ops->init(b.lock);
+    b.cs_iters = (long)(cs_ns * iters_per_ns);
+    b.outside_iters = (long)(OUTSIDE_NS * iters_per_ns);
+    atomic_init(&b.stop, 0);
+    b.shared = 0;
+
+    long switches = context_switches();
+    double start = timing_now();
+    for (int i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, worker, &b);
+    usleep(RUN_MS * 1000);
+    atomic_store(&b.stop, 1);
+    long total = 0;
+    for (int i = 0; i < nthreads; i++) {
+        void *ops_done;
+        pthread_join(threads[i], &ops_done);
+        total += (long)ops_done;
+    }
+    double elapsed = timing_now() - start;
+    switches = context_switches() - switches;
+
+    if (b.shared != total)
+        fprintf(stderr, "%s: lost updates (%ld of %ld)\n", ops->name, total - b.shared, total);
+    printf("%s,%d,%d,%.0f,%.1f,%.3f\n", ops->name, cs_ns, nthreads, total / elapsed,
+           elapsed * 1e9 / total, (double)switches / total);
+    fflush(stdout);
+
+    ops->destroy(b.lock);
+    free(b.lock);
+}
+
+int main(int argc, char *argv[]) {
+    int nthreads = 4;
+    if (argc > 2 || (argc == 2 && atoi(argv[1]) <= 0)) {
+        fprintf(stderr, "usage: spin_park [threads]\n");
+        exit(1);
+    }
+    if (argc == 2)
+        nthreads = atoi(argv[1]);
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+
+    calibrate();
+    fprintf(stderr, "%d threads on %ld CPUs, %.2f busy iterations per ns\n",
+            nthreads, sysconf(_SC_NPROCESSORS_ONLN), iters_per_ns);
+
+    printf("lock,cs_ns,threads,ops_per_sec,ns_per_op,switches_per_op\n");
+    int num_lengths = sizeof(cs_lengths) / sizeof(cs_lengths[0]);
+    int num_locks = sizeof(locks) / sizeof(locks[0]);
+    for (int c = 0; c < num_lengths; c++) {
+        for (int k = 0; k < num_locks; k++)
+            run_cell(&locks[k], cs_lengths[c], nthreads);
+    }
+    return 0;
+}
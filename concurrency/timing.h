@@ -0,0 +1,219 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Low-overhead timing
+ * gettimeofday() has microsecond resolution, and even clock_gettime() through the vDSO
+ * costs ~20 ns a call, too coarse and too slow for critical sections of tens of ns.
+ * With an invariant TSC (constant rate, keeps ticking in idle states: CPUID
+ * 0x80000007 EDX bit 8), one rdtsc is a few ns. On first use the TSC is calibrated
+ * against CLOCK_MONOTONIC over TIMING_CALIBRATE_NS, so cycles convert to ns and
+ * timing_ns() stays on the CLOCK_MONOTONIC time line.
+ * Without an invariant TSC (or built with -DTIMING_NO_TSC) every reader falls back
+ * to clock_gettime(CLOCK_MONOTONIC), and a "cycle" is a nanosecond.
+ *
+ *     uint64_t t0 = timing_start();
+ *     ... short section ...
+ *     double ns = timing_elapsed_ns(t0, timing_stop());    // Reader overhead taken out
+ *
+ *     timing_spin_ns(200);    // Busy-wait 200 ns
+ */
+
+#ifndef __timing_h__
+#define __timing_h__
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(TIMING_NO_TSC)
+#include <x86intrin.h>
+#include <cpuid.h>
+#define TIMING_HAVE_TSC 1
+#else
+#define TIMING_HAVE_TSC 0
+#endif
+
+#define TIMING_CALIBRATE_NS 10000000    // 10 ms
+#define TIMING_PAIR_TRIES 5             // Best-of for each (TSC, CLOCK_MONOTONIC) reading
+
+typedef struct
+{
+    int use_tsc;
+    double ns_per_cycle;
+    uint64_t base_cycles;       // Cycle count at base_ns
+    uint64_t base_ns;           // CLOCK_MONOTONIC
+    uint64_t overhead_cycles;   // Smallest timing_stop() - timing_start()
+} timing_t;
+
+static timing_t timing_global;
+static pthread_once_t timing_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t timing_mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int timing_invariant_tsc(void) {
+#if TIMING_HAVE_TSC
+    unsigned a, b, c, d;
+    if (__get_cpuid(0x80000000, &a, &b, &c, &d) == 0 || a < 0x80000007)
+        return 0;
+    __get_cpuid(0x80000007, &a, &b, &c, &d);
+    return (d >> 8) & 1;
+#else
+    return 0;
+#endif
+}
+
+// Raw readers; only meaningful after timing_init() picked the source
+static inline uint64_t timing_read(int use_tsc) {
+#if TIMING_HAVE_TSC
+    if (use_tsc)
+        return __rdtsc();
+#endif
+    (void)use_tsc;
+    return timing_mono_ns();
+}
+
+// Ordered readers for short sections: the start read waits for earlier instructions
+// to finish; the stop read waits for the section and keeps later work from starting early
+static inline uint64_t timing_read_start(int use_tsc) {
+#if TIMING_HAVE_TSC
+    if (use_tsc) {
+        _mm_lfence();
+        return __rdtsc();
+    }
+#endif
+    (void)use_tsc;
+    return timing_mono_ns();
+}
+
+static inline uint64_t timing_read_stop(int use_tsc) {
+#if TIMING_HAVE_TSC
+    if (use_tsc) {
+        unsigned aux;
+        uint64_t c = __rdtscp(&aux);
+        _mm_lfence();
+        return c;
+    }
+#endif
+    (void)use_tsc;
+    return timing_mono_ns();
+}
+
+// A CLOCK_MONOTONIC reading and the TSC at the same moment: the midpoint of the
+// tightest rdtsc pair around clock_gettime out of a few tries
+static inline void timing_pair(uint64_t *cycles, uint64_t *ns) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < TIMING_PAIR_TRIES; i++) {
+        uint64_t before = timing_read(1);
+        uint64_t mono = timing_mono_ns();
+        uint64_t after = timing_read(1);
+        if (after - before < best) {
+            best = after - before;
+            *cycles = before + (after - before) / 2;
+            *ns = mono;
+        }
+    }
+}
+
+static inline void timing_calibrate(void) {
+    timing_t *t = &timing_global;
+    t->use_tsc = timing_invariant_tsc();
+    if (!t->use_tsc) {
+        t->ns_per_cycle = 1.0;
+        t->base_ns = t->base_cycles = timing_mono_ns();
+    } else {
+        uint64_t c0 = 0, n0 = 0, c1 = 0, n1 = 0;
+        timing_pair(&c0, &n0);
+        while (timing_mono_ns() - n0 < TIMING_CALIBRATE_NS)
+            ;
+        timing_pair(&c1, &n1);
+        t->ns_per_cycle = (double)(n1 - n0) / (double)(c1 - c0);
+        t->base_cycles = c0;
+        t->base_ns = n0;
+    }
+
+    t->overhead_cycles = UINT64_MAX;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t a = timing_read_start(t->use_tsc);
+        uint64_t b = timing_read_stop(t->use_tsc);
+        if (b - a < t->overhead_cycles)
+            t->overhead_cycles = b - a;
+    }
+}
+
+static inline timing_t *timing_init(void) {
+    pthread_once(&timing_once, timing_calibrate);
+    return &timing_global;
+}
+
+// Cycles (ns in fallback mode). Unordered: the CPU may run it early or late
+// by a few instructions, fine for anything longer than ~100 ns.
+static inline uint64_t timing_cycles(void) {
+    return timing_read(timing_init()->use_tsc);
+}
+
+// Ordered pair for timing short sections; see timing_elapsed_ns()
+static inline uint64_t timing_start(void) {
+    return timing_read_start(timing_init()->use_tsc);
+}
+
+static inline uint64_t timing_stop(void) {
+    return timing_read_stop(timing_init()->use_tsc);
+}
+
+static inline double timing_cycles_to_ns(uint64_t cycles) {
+    return cycles * timing_init()->ns_per_cycle;
+}
+
+static inline uint64_t timing_ns_to_cycles(uint64_t ns) {
+    return (uint64_t)(ns / timing_init()->ns_per_cycle);
+}
+
+// timing_stop() - timing_start() in ns, less the cost of the readers themselves
+static inline double timing_elapsed_ns(uint64_t start, uint64_t stop) {
+    timing_t *t = timing_init();
+    uint64_t d = stop - start;
+    return d > t->overhead_cycles ? (d - t->overhead_cycles) * t->ns_per_cycle : 0.0;
+}
+
+// A timing_cycles() reading as nanoseconds on the CLOCK_MONOTONIC time line;
+// lets a hot path store raw cycles and convert later
+static inline uint64_t timing_cycles_to_mono_ns(uint64_t cycles) {
+    timing_t *t = timing_init();
+    return t->base_ns + (uint64_t)((int64_t)(cycles - t->base_cycles) * t->ns_per_cycle);
+}
+
+// Nanoseconds on the CLOCK_MONOTONIC time line
+static inline uint64_t timing_ns(void) {
+    return timing_cycles_to_mono_ns(timing_cycles());
+}
+
+// Seconds, for the usual end - start arithmetic (the old get_time())
+static inline double timing_now(void) {
+    return timing_ns() / 1e9;
+}
+
+// Busy-wait for ns nanoseconds of wall time
+static inline void timing_spin_ns(uint64_t ns) {
+    uint64_t end = timing_cycles() + timing_ns_to_cycles(ns);
+    while (timing_cycles() < end) {
+#if TIMING_HAVE_TSC
+        _mm_pause();
+#endif
+    }
+}
+
+// "tsc (2.994 GHz)" or "clock_gettime"
+static inline const char *timing_source(void) {
+    static char buf[64];
+    timing_t *t = timing_init();
+    if (!t->use_tsc)
+        return "clock_gettime";
+    snprintf(buf, sizeof(buf), "tsc (%.3f GHz)", 1.0 / t->ns_per_cycle);
+    return buf;
+}
+
+#endif // __timing_h__
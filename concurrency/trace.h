@@ -0,0 +1,208 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Per-thread binary trace buffers (use instead of printf in hot paths)
+ * TRACE(event, a0, a1) writes one fixed-size record into the calling thread's ring:
+ * no locks, no syscalls (timestamps come from the vDSO clock), oldest records are overwritten.
+ * trace_write() saves every ring to a file; trace_decode.c turns it into text or Chrome trace JSON.
+ *
+ * Call trace_thread_init() at the top of each traced thread, before its timed loop: it takes
+ * a ring and faults its pages in, so TRACE() itself never allocates. (Without it the first
+ * TRACE() on a thread does that work.) A ring is handed back when its thread exits; once
+ * TRACE_MAX_THREADS rings exist, new threads reuse those, so a trace "tid" is really a ring
+ * and may show several short-lived threads one after another. Threads beyond
+ * TRACE_MAX_THREADS alive at once are not traced, and trace_write() reports how many.
+ *
+ * Build with -DTRACE_DISABLE to compile every TRACE() away.
+ */
+
+#ifndef __trace_h__
+#define __trace_h__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include "timing.h"
+
+#define TRACE_RING_SIZE (1 << 16)    // Records per thread, power of two
+#define TRACE_MAX_THREADS 256
+#define TRACE_MAGIC "OSTEPTRC"
+#define TRACE_VERSION 1
+
+// Chrome trace phases
+#define TRACE_INSTANT 'i'
+#define TRACE_BEGIN   'B'
+#define TRACE_END     'E'
+#define TRACE_COUNTER 'C'
+
+typedef struct
+{
+    uint64_t ts_ns;    // timing_cycles() in the ring; trace_write converts to CLOCK_MONOTONIC ns
+    uint64_t arg1;
+    uint16_t event;    // Index into the names table passed to trace_write
+    uint8_t phase;
+    uint8_t pad;
+    uint32_t arg0;
+} trace_rec_t;
+
+typedef struct
+{
+    uint64_t head;     // Records ever written; only the owner thread writes it
+    uint32_t tid;
+    atomic_int in_use; // 0 once the owner exited: the next new thread may take it
+    trace_rec_t recs[TRACE_RING_SIZE];
+} trace_ring_t;
+
+static _Atomic(trace_ring_t *) trace_rings[TRACE_MAX_THREADS];
+static atomic_int trace_num_rings = 0;
+static atomic_int trace_dropped_threads = 0;
+static __thread trace_ring_t *trace_self = NULL;
+
+#ifndef TRACE_DISABLE
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static __thread int trace_dropped = 0;
+
+// Thread exit: hand the ring (and the records in it) to the next thread
+static void trace_ring_release(void *arg) {
+    trace_ring_t *r = (trace_ring_t *)arg;
+    atomic_store_explicit(&r->in_use, 0, memory_order_release);
+    trace_self = NULL;
+}
+
+static void trace_key_create(void) {
+    pthread_key_create(&trace_key, trace_ring_release);
+}
+
+// New ring while there is room, then rings from exited threads (cold path)
+static inline trace_ring_t *trace_ring_claim(void) {
+    int idx = atomic_load(&trace_num_rings);
+    while (idx < TRACE_MAX_THREADS && !atomic_compare_exchange_weak(&trace_num_rings, &idx, idx + 1))
+        ;
+    if (idx >= TRACE_MAX_THREADS) {
+        for (int i = 0; i < TRACE_MAX_THREADS; i++) {
+            trace_ring_t *r = atomic_load_explicit(&trace_rings[i], memory_order_acquire);
+            int free_ring = 0;
+            if (r != NULL && atomic_compare_exchange_strong(&r->in_use, &free_ring, 1))
+                return r;
+        }
+        return NULL;
+    }
+
+    // malloc + memset rather than calloc: fault every page in now, not in TRACE()
+    trace_ring_t *r = malloc(sizeof(trace_ring_t));
+    memset(r, 0, sizeof(trace_ring_t));
+    r->tid = idx;
+    atomic_init(&r->in_use, 1);
+    atomic_store_explicit(&trace_rings[idx], r, memory_order_release);
+    return r;
+}
+
+// Take a ring for this thread; call before the hot loop
+static inline void trace_thread_init(void) {
+    if (trace_self != NULL || trace_dropped)
+        return;
+    pthread_once(&trace_once, trace_key_create);
+    timing_init();    // Calibrate here, not in the first TRACE()
+    trace_self = trace_ring_claim();
+    if (trace_self == NULL) {
+        trace_dropped = 1;
+        atomic_fetch_add(&trace_dropped_threads, 1);
+        return;
+    }
+    pthread_setspecific(trace_key, trace_self);
+}
+#else
+static inline void trace_thread_init(void) { }
+#endif
+
+static inline trace_ring_t *trace_ring_get(void) {
+    if (__builtin_expect(trace_self == NULL, 0))
+        trace_thread_init();    // Thread didn't call it: pay for the ring here, once
+    return trace_self;
+}
+
+static inline void trace_emit(uint16_t event, uint8_t phase, uint32_t a0, uint64_t a1) {
+    trace_ring_t *r = trace_ring_get();
+    if (r == NULL)
+        return;
+    trace_rec_t *rec = &r->recs[r->head & (TRACE_RING_SIZE - 1)];
+    rec->ts_ns = timing_cycles();
+    rec->event = event;
+    rec->phase = phase;
+    rec->arg0 = a0;
+    rec->arg1 = a1;
+    // Release so a concurrent trace_write never sees head ahead of the record
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef TRACE_DISABLE
+#define TRACE(ev, a0, a1)        do { } while (0)
+#define TRACE_BEGIN_EV(ev, a0)   do { } while (0)
+#define TRACE_END_EV(ev, a0)     do { } while (0)
+#else
+#define TRACE(ev, a0, a1)        trace_emit((ev), TRACE_INSTANT, (uint32_t)(a0), (uint64_t)(a1))
+#define TRACE_BEGIN_EV(ev, a0)   trace_emit((ev), TRACE_BEGIN, (uint32_t)(a0), 0)
+#define TRACE_END_EV(ev, a0)     trace_emit((ev), TRACE_END, (uint32_t)(a0), 0)
+#endif
+
+/**
+ * File layout (little endian, native struct layout):
+ *   "OSTEPTRC" u32 version  u32 num_names  { u16 len, name bytes } * num_names
+ *   u32 num_rings  { u32 tid, u64 head, u32 count, trace_rec_t * count } * num_rings
+ * Call after the traced threads are done (or accept a few torn records at the ring edge).
+ */
+static inline int trace_write(const char *path, const char *const names[], int num_names) {
+    FILE *out = fopen(path, "wb");
+    if (out == NULL) {
+        perror(path);
+        return -1;
+    }
+
+    uint32_t version = TRACE_VERSION, n = num_names;
+    fwrite(TRACE_MAGIC, 1, 8, out);
+    fwrite(&version, sizeof(version), 1, out);
+    fwrite(&n, sizeof(n), 1, out);
+    for (int i = 0; i < num_names; i++) {
+        uint16_t len = (uint16_t)strlen(names[i]);
+        fwrite(&len, sizeof(len), 1, out);
+        fwrite(names[i], 1, len, out);
+    }
+
+    int rings = atomic_load(&trace_num_rings);
+    uint32_t num_rings = rings < TRACE_MAX_THREADS ? rings : TRACE_MAX_THREADS;
+    fwrite(&num_rings, sizeof(num_rings), 1, out);
+    for (uint32_t i = 0; i < num_rings; i++) {
+        trace_ring_t *r = atomic_load_explicit(&trace_rings[i], memory_order_acquire);
+        uint64_t head = r != NULL ? __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) : 0;
+        uint32_t count = head < TRACE_RING_SIZE ? (uint32_t)head : TRACE_RING_SIZE;
+        fwrite(&i, sizeof(i), 1, out);
+        fwrite(&head, sizeof(head), 1, out);
+        fwrite(&count, sizeof(count), 1, out);
+        // Oldest first
+        for (uint64_t k = head - count; k < head; k++) {
+            trace_rec_t rec = r->recs[k & (TRACE_RING_SIZE - 1)];
+            rec.ts_ns = timing_cycles_to_mono_ns(rec.ts_ns);
+            fwrite(&rec, sizeof(trace_rec_t), 1, out);
+        }
+    }
+
+    fclose(out);
+    int dropped = atomic_load(&trace_dropped_threads);
+    if (dropped > 0)
+        fprintf(stderr, "trace: %d threads not traced (more than %d alive at once)\n", dropped, TRACE_MAX_THREADS);
+    return 0;
+}
+
+// Write to $OSTEP_TRACE if it is set; lets every program trace without new flags
+static inline void trace_write_env(const char *const names[], int num_names) {
+    const char *path = getenv("OSTEP_TRACE");
+    if (path != NULL && trace_write(path, names, num_names) == 0)
+        fprintf(stderr, "Trace written to %s (decode with trace_decode)\n", path);
+}
+
+#endif // __trace_h__
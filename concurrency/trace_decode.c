@@ -0,0 +1,122 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Offline decoder for trace.h files
+ * Merges every thread's ring by timestamp and prints it as text,
+ * or as Chrome trace JSON (load in chrome://tracing or ui.perfetto.dev).
+ *
+ * usage: trace_decode <file> [--chrome]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+typedef struct
+{
+    trace_rec_t rec;
+    uint32_t tid;
+} event_t;
+
+int cmp_event(const void *a, const void *b) {
+    const event_t *x = a, *y = b;
+    return (x->rec.ts_ns > y->rec.ts_ns) - (x->rec.ts_ns < y->rec.ts_ns);
+}
+
+void read_or_die(void *buf, size_t size, FILE *in) {
+    if (fread(buf, 1, size, in) != size) {
+        fprintf(stderr, "truncated trace file\n");
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || (argc == 3 && strcmp(argv[2], "--chrome") != 0) || argc > 3) {
+        fprintf(stderr, "usage: trace_decode <file> [--chrome]\n");
+        exit(1);
+    }
+    int chrome = argc == 3;
+
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        exit(1);
+    }
+
+    char magic[8];
+    uint32_t version, num_names;
+    read_or_die(magic, 8, in);
+    read_or_die(&version, sizeof(version), in);
+    if (memcmp(magic, TRACE_MAGIC, 8) != 0 || version != TRACE_VERSION) {
+        fprintf(stderr, "%s: not a version %d trace file\n", argv[1], TRACE_VERSION);
+        exit(1);
+    }
+
+    read_or_die(&num_names, sizeof(num_names), in);
+    char **names = calloc(num_names, sizeof(char *));
+    for (uint32_t i = 0; i < num_names; i++) {
+        uint16_t len;
+        read_or_die(&len, sizeof(len), in);
+        names[i] = calloc(len + 1, 1);
+        read_or_die(names[i], len, in);
+    }
+
+    uint32_t num_rings;
+    read_or_die(&num_rings, sizeof(num_rings), in);
+    event_t *events = NULL;
+    size_t num_events = 0;
+    uint64_t dropped = 0;
+
+    for (uint32_t r = 0; r < num_rings; r++) {
+        uint32_t tid, count;
+        uint64_t head;
+        read_or_die(&tid, sizeof(tid), in);
+        read_or_die(&head, sizeof(head), in);
+        read_or_die(&count, sizeof(count), in);
+        dropped += head - count;   // Overwritten by the ring
+
+        events = realloc(events, (num_events + count) * sizeof(event_t));
+        for (uint32_t k = 0; k < count; k++) {
+            read_or_die(&events[num_events].rec, sizeof(trace_rec_t), in);
+            events[num_events].tid = tid;
+            num_events++;
+        }
+    }
+    fclose(in);
+
+    qsort(events, num_events, sizeof(event_t), cmp_event);
+    uint64_t t0 = num_events > 0 ? events[0].rec.ts_ns : 0;
+
+    if (chrome)
+        printf("{\"traceEvents\": [\n");
+    for (size_t i = 0; i < num_events; i++) {
+        trace_rec_t *e = &events[i].rec;
+        const char *name = e->event < num_names ? names[e->event] : "unknown";
+        double us = (e->ts_ns - t0) / 1000.0;
+
+        if (chrome) {
+            printf("%s  {\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %u, ",
+                   i > 0 ? ",\n" : "", name, e->phase, us, events[i].tid);
+            if (e->phase == TRACE_COUNTER)
+                printf("\"args\": {\"value\": %llu}}", (unsigned long long)e->arg1);
+            else
+                printf("%s\"args\": {\"arg0\": %u, \"arg1\": %llu}}",
+                       e->phase == TRACE_INSTANT ? "\"s\": \"t\", " : "", e->arg0, (unsigned long long)e->arg1);
+        } else {
+            printf("%12.3f us  tid %-3u %c %-24s arg0=%u arg1=%llu\n", us, events[i].tid, e->phase, name,
+                   e->arg0, (unsigned long long)e->arg1);
+        }
+    }
+    if (chrome)
+        printf("\n]}\n");
+
+    fprintf(stderr, "%zu events from %u threads (%llu overwritten)\n", num_events, num_rings,
+            (unsigned long long)dropped);
+
+    for (uint32_t i = 0; i < num_names; i++)
+        free(names[i]);
+    free(names);
+    free(events);
+    return 0;
+}
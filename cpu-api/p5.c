@@ -0,0 +1,301 @@
+// fork() + shared memory queue
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "../concurrency/futex.h"
+#include "../concurrency/timing.h"
+
+#define NUM_CHILDREN 4
+#define NUM_TASKS 1000000
+#define QUEUE_SLOTS 4096    // Must be a power of two
+#define SPIN_TRIES 100      // Retries before sleeping in the kernel
+#define FEED_BATCH 256
+
+typedef struct
+{
+    int64_t id;     // -1 tells a child to exit
+    int64_t value;
+} item_t;
+
+// Bounded MPMC ring (Vyukov): a slot is free for position pos when seq == pos,
+// and full when seq == pos + 1
+typedef struct
+{
+    atomic_ulong seq;
+    item_t item;
+} slot_t;
+
+// Lives in the MAP_SHARED mapping, so everything in it is visible to parent and children.
+// No pointers inside: the struct is position independent.
+typedef struct
+{
+    _Alignas(64) atomic_ulong enq_pos;
+    _Alignas(64) atomic_ulong deq_pos;
+    // Futex words: bumped after each enqueue/dequeue, waited on when empty/full
+    _Alignas(64) atomic_uint items_seq;
+    atomic_uint items_waiters;
+    _Alignas(64) atomic_uint space_seq;
+    atomic_uint space_waiters;
+    _Alignas(64) slot_t slots[QUEUE_SLOTS];
+} shm_queue_t;
+
+void shm_queue_init(shm_queue_t *q) {
+    atomic_init(&q->enq_pos, 0);
+    atomic_init(&q->deq_pos, 0);
+    atomic_init(&q->items_seq, 0);
+    atomic_init(&q->items_waiters, 0);
+    atomic_init(&q->space_seq, 0);
+    atomic_init(&q->space_waiters, 0);
+    for (unsigned long i = 0; i < QUEUE_SLOTS; i++) {
+        atomic_init(&q->slots[i].seq, i);
+    }
+}
+
+int shm_try_enqueue(shm_queue_t *q, item_t item) {
+    unsigned long pos = atomic_load_explicit(&q->enq_pos, memory_order_relaxed);
+    slot_t *slot;
+    while (1) {
+        slot = &q->slots[pos & (QUEUE_SLOTS - 1)];
+        long dif = (long)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak(&q->enq_pos, &pos, pos + 1))
+                break;
+        } else if (dif < 0) {
+            return -1;   // Full
+        } else {
+            pos = atomic_load_explicit(&q->enq_pos, memory_order_relaxed);
+        }
+    }
+    slot->item = item;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+int shm_try_dequeue(shm_queue_t *q, item_t *item) {
+    unsigned long pos = atomic_load_explicit(&q->deq_pos, memory_order_relaxed);
+    slot_t *slot;
+    while (1) {
+        slot = &q->slots[pos & (QUEUE_SLOTS - 1)];
+        long dif = (long)(atomic_load_explicit(&slot->seq, memory_order_acquire) - (pos + 1));
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak(&q->deq_pos, &pos, pos + 1))
+                break;
+        } else if (dif < 0) {
+            return -1;   // Empty
+        } else {
+            pos = atomic_load_explicit(&q->deq_pos, memory_order_relaxed);
+        }
+    }
+    *item = slot->item;
+    atomic_store_explicit(&slot->seq, pos + QUEUE_SLOTS, memory_order_release);
+    return 0;
+}
+
+// Sleep on word unless it already moved past seen
+void shm_block(atomic_uint *word, atomic_uint *waiters, unsigned seen) {
+    atomic_fetch_add(waiters, 1);
+    futex_wait_shared(word, seen);
+    atomic_fetch_sub(waiters, 1);
+}
+
+// n items/slots became available
+void shm_notify(atomic_uint *word, atomic_uint *waiters, int n) {
+    atomic_fetch_add(word, 1);
+    if (atomic_load(waiters) > 0)   // No syscall unless someone sleeps
+        futex_wake_shared(word, n);
+}
+
+void shm_enqueue(shm_queue_t *q, item_t item) {
+    for (int tries = 0; ; tries++) {
+        unsigned seen = atomic_load(&q->space_seq);
+        if (shm_try_enqueue(q, item) == 0)
+            break;
+        if (tries >= SPIN_TRIES)
+            shm_block(&q->space_seq, &q->space_waiters, seen);
+    }
+    shm_notify(&q->items_seq, &q->items_waiters, 1);
+}
+
+item_t shm_dequeue(shm_queue_t *q) {
+    item_t item;
+    for (int tries = 0; ; tries++) {
+        unsigned seen = atomic_load(&q->items_seq);
+        if (shm_try_dequeue(q, &item) == 0)
+            break;
+        if (tries >= SPIN_TRIES)
+            shm_block(&q->items_seq, &q->items_waiters, seen);
+    }
+    shm_notify(&q->space_seq, &q->space_waiters, 1);
+    return item;
+}
+
+int64_t do_work(int64_t v) {
+    return v * v + 1;
+}
+
+// Same fan-out through pipes, for comparison
+double run_pipes(int64_t *sum) {
+    int tasks[2], results[2];
+    if (pipe(tasks) < 0 || pipe(results) < 0) {
+        fprintf(stderr, "pipe failed\n");
+        exit(1);
+    }
+
+    fflush(stdout);   // Don't let children inherit (and re-print) buffered output
+    double start = timing_now();
+    for (int c = 0; c < NUM_CHILDREN; c++) {
+        int rc = fork();
+        if (rc < 0) {
+            fprintf(stderr, "fork failed\n");
+            exit(1);
+        } else if (rc == 0) {
+            // child: writes of <= PIPE_BUF bytes are atomic, so items never interleave
+            close(tasks[1]);
+            close(results[0]);
+            item_t it;
+            while (read(tasks[0], &it, sizeof(it)) == sizeof(it) && it.id >= 0) {
+                it.value = do_work(it.value);
+                if (write(results[1], &it, sizeof(it)) != sizeof(it))
+                    exit(1);
+            }
+            exit(0);
+        }
+    }
+    close(tasks[0]);
+    close(results[1]);
+
+    // Feed from a second child so the parent can collect at the same time
+    // (otherwise both pipes fill up and everyone blocks)
+    int feeder = fork();
+    if (feeder == 0) {
+        close(results[0]);
+        for (int64_t i = 0; i < NUM_TASKS + NUM_CHILDREN; i++) {
+            item_t it = { i < NUM_TASKS ? i : -1, i };
+            if (write(tasks[1], &it, sizeof(it)) != sizeof(it))
+                exit(1);
+        }
+        exit(0);
+    }
+    close(tasks[1]);
+
+    *sum = 0;
+    item_t it;
+    for (int i = 0; i < NUM_TASKS; i++) {
+        if (read(results[0], &it, sizeof(it)) != sizeof(it))
+            break;
+        *sum += it.value;
+    }
+    while (wait(NULL) > 0)
+        ;
+    close(results[0]);
+    return timing_now() - start;
+}
+
+double run_shm(int64_t *sum) {
+    // Mapped before fork(), so every child sees the same physical pages
+    shm_queue_t *queues = mmap(NULL, 2 * sizeof(shm_queue_t), PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (queues == MAP_FAILED) {
+        fprintf(stderr, "mmap failed\n");
+        exit(1);
+    }
+    shm_queue_t *tasks = &queues[0];
+    shm_queue_t *results = &queues[1];
+    shm_queue_init(tasks);
+    shm_queue_init(results);
+
+    fflush(stdout);   // Don't let children inherit (and re-print) buffered output
+    double start = timing_now();
+    for (int c = 0; c < NUM_CHILDREN; c++) {
+        int rc = fork();
+        if (rc < 0) {
+            fprintf(stderr, "fork failed\n");
+            exit(1);
+        } else if (rc == 0) {
+            // child: pull tasks until told to stop
+            while (1) {
+                item_t it = shm_dequeue(tasks);
+                if (it.id < 0)
+                    break;
+                it.value = do_work(it.value);
+                shm_enqueue(results, it);
+            }
+            exit(0);
+        }
+    }
+
+    // parent: interleave feeding and collecting so neither ring stays full
+    *sum = 0;
+    int64_t sent = 0, received = 0;
+    item_t it;
+    while (received < NUM_TASKS) {
+        // One wakeup per batch, not per item
+        int batch = 0;
+        while (batch < FEED_BATCH && sent < NUM_TASKS &&
+               shm_try_enqueue(tasks, (item_t){ sent, sent }) == 0) {
+            sent++;
+            batch++;
+        }
+        if (batch > 0)
+            shm_notify(&tasks->items_seq, &tasks->items_waiters, batch);
+
+        // Collect in batches too
+        int got = 0;
+        while (got < FEED_BATCH && shm_try_dequeue(results, &it) == 0) {
+            *sum += it.value;
+            got++;
+        }
+        if (got > 0) {
+            shm_notify(&results->space_seq, &results->space_waiters, got);
+        } else if (sent == NUM_TASKS) {
+            it = shm_dequeue(results);   // Nothing left to feed: just block
+            *sum += it.value;
+            got = 1;
+        }
+        received += got;
+    }
+    for (int c = 0; c < NUM_CHILDREN; c++) {
+        shm_enqueue(tasks, (item_t){ -1, 0 });
+    }
+    while (wait(NULL) > 0)
+        ;
+
+    double elapsed = timing_now() - start;
+    munmap(queues, 2 * sizeof(shm_queue_t));
+    return elapsed;
+}
+
+int
+main(int argc, char *argv[])
+{
+    printf("Parent (pid:%d) fanning %d tasks out to %d children\n",
+           (int)getpid(), NUM_TASKS, NUM_CHILDREN);
+
+    int64_t expected = 0;
+    for (int64_t i = 0; i < NUM_TASKS; i++) {
+        expected += do_work(i);
+    }
+
+    int64_t sum;
+    double t = run_pipes(&sum);
+    printf("pipes:         %.3f seconds, %.0f tasks/sec %s\n", t, NUM_TASKS / t,
+           sum == expected ? "(correct)" : "(WRONG)");
+
+    t = run_shm(&sum);
+    printf("shared memory: %.3f seconds, %.0f tasks/sec %s\n", t, NUM_TASKS / t,
+           sum == expected ? "(correct)" : "(WRONG)");
+    return 0;
+}
+
+/**
+ * The queue lives in a MAP_SHARED|MAP_ANONYMOUS mapping created before fork(),
+ * so parent and children share the same physical pages (normal fork() memory is copy-on-write).
+ * No read()/write() syscall per item: producers and consumers only touch shared cache lines,
+ * and futex() is called only when a side actually has to sleep.
+ * The futexes are the non-PRIVATE kind, because the waiters are in different processes.
+ */
@@ -0,0 +1,194 @@
+// What sharing a cache line costs
+//
+// threads.c has two threads hammer one volatile counter; this puts a number on it.
+//
+// 1. Core-to-core matrix: for every pair of CPUs, two threads pinned there pass
+//    one cache line back and forth with compare-and-swap (0 -> 1 on one side,
+//    1 -> 0 on the other). Each hop moves the line to the other core, so the
+//    round trip is two cache-line transfers. Best of SAMPLES batches, in ns.
+//    The matrix is symmetric, so each pair is measured once and mirrored.
+//    Also summarized by topology: SMT siblings, same package, other package.
+// 2. False sharing: two threads each increment their own counter, with the two
+//    counters in one cache line vs. on separate lines, on placement threads 0 and 1.
+//
+// CPUs come from $OSTEP_PLACE (placement.h); "none" measures every CPU in compact order.
+// Put producer and consumer on the pair with the cheapest round trip.
+//
+// usage: c2c [round_trips]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include "../concurrency/bench.h"
+
+#define SAMPLES 5                       // Timed batches per pair, best one reported
+#define FALSE_SHARING_OPS 10000000
+
+long round_trips = 2000;
+
+// The line the pair fights over
+typedef struct
+{
+    _Alignas(64) atomic_int flag;
+} pingpong_line_t;
+
+pingpong_line_t line;
+
+typedef struct
+{
+    int tid;
+    double best_ns;    // tid 0 only: best round trip
+} pingpong_arg_t;
+
+// tid 0 moves the flag 0 -> 1, tid 1 moves it 1 -> 0
+void* pingpong_worker(void* arg) {
+    pingpong_arg_t *a = (pingpong_arg_t *)arg;
+    int mine = a->tid;
+    a->best_ns = 0;
+
+    for (int s = 0; s <= SAMPLES; s++) {    // Batch 0 is warmup
+        uint64_t t0 = timing_start();
+        for (long r = 0; r < round_trips; r++) {
+            int expected = mine, spins = 0;
+            while (!atomic_compare_exchange_weak_explicit(&line.flag, &expected, !mine,
+                                                          memory_order_acq_rel, memory_order_relaxed)) {
+                expected = mine;
+                lock_spin(&spins);
+            }
+        }
+        double ns = timing_elapsed_ns(t0, timing_stop()) / round_trips;
+        if (s > 0 && (a->best_ns == 0 || ns < a->best_ns))
+            a->best_ns = ns;
+    }
+    return NULL;
+}
+
+double pair_round_trip(int cpu_a, int cpu_b) {
+    placement_t pair;
+    char list[32];
+    pingpong_arg_t args[2] = { { .tid = 0 }, { .tid = 1 } };
+
+    snprintf(list, sizeof(list), "%d,%d", cpu_a, cpu_b);
+    placement_init(&pair, list);
+    atomic_store(&line.flag, 0);
+    bench_t b = { .nthreads = 2, .worker = pingpong_worker, .args = args, .arg_size = sizeof(args[0]),
+                  .ops_per_thread = round_trips, .placement = &pair };
+    bench_run(&b);
+    return args[0].best_ns;
+}
+
+// False sharing: counters side by side vs. a line each
+typedef struct
+{
+    volatile long a;
+    volatile long b;
+} adjacent_t;
+
+typedef struct
+{
+    _Alignas(64) volatile long v;
+} padded_t;
+
+adjacent_t adjacent;
+padded_t padded[2];
+
+void* count_worker(void* arg) {
+    volatile long *c = *(volatile long **)arg;
+    for (long i = 0; i < FALSE_SHARING_OPS; i++)
+        (*c)++;
+    return NULL;
+}
+
+double count_ns(volatile long *c0, volatile long *c1) {
+    volatile long *args[2] = { c0, c1 };
+    bench_t b = { .nthreads = 2, .worker = count_worker, .args = args, .arg_size = sizeof(args[0]),
+                  .ops_per_thread = FALSE_SHARING_OPS };
+    bench_run(&b);
+    return b.seconds * 1e9 / FALSE_SHARING_OPS;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1)
+        round_trips = atol(argv[1]);
+    if (argc > 2 || round_trips <= 0) {
+        fprintf(stderr, "usage: c2c [round_trips]\n");
+        exit(1);
+    }
+
+    static placement_t place;
+    place = *placement_default();
+    if (!place.pin)
+        placement_init(&place, "compact");
+    int n = place.num_cpus;
+    static cpu_info_t info[CPU_SETSIZE];
+    for (int i = 0; i < n; i++)
+        placement_read_cpu(&info[i], place.cpus[i]);
+
+    printf("Timer: %s\n", timing_source());
+    placement_print(&place, stdout);
+    printf("CAS round trip, ns (best of %d x %ld):\n      ", SAMPLES, round_trips);
+    for (int j = 0; j < n; j++)
+        printf(" %5d", place.cpus[j]);
+    printf("\n");
+
+    double sum[3] = { 0, 0, 0 }, lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+    int count[3] = { 0, 0, 0 };
+    const char *kinds[3] = { "SMT siblings", "same package", "other package" };
+    // The round trip is symmetric: measure each pair once (j > i) and mirror it
+    double *matrix = malloc((size_t)n * n * sizeof(double));
+    assert(matrix != NULL);
+    for (int i = 0; i < n; i++) {
+        printf("  %3d ", place.cpus[i]);
+        for (int j = 0; j < n; j++) {
+            if (place.cpus[i] == place.cpus[j]) {
+                printf(" %5s", "-");
+                continue;
+            }
+            if (j < i) {
+                printf(" %5.0f", matrix[i * n + j]);
+                continue;
+            }
+            double ns = pair_round_trip(place.cpus[i], place.cpus[j]);
+            matrix[i * n + j] = matrix[j * n + i] = ns;
+            printf(" %5.0f", ns);
+            fflush(stdout);
+            int k = info[i].package != info[j].package ? 2 : info[i].core != info[j].core ? 1 : 0;
+            lo[k] = count[k] == 0 || ns < lo[k] ? ns : lo[k];
+            hi[k] = count[k] == 0 || ns > hi[k] ? ns : hi[k];
+            sum[k] += ns;
+            count[k]++;
+        }
+        printf("\n");
+    }
+    free(matrix);
+    for (int k = 0; k < 3; k++) {
+        if (count[k] > 0)
+            printf("  %-14s %4d pairs: min %5.0f  avg %5.0f  max %5.0f ns\n",
+                   kinds[k], count[k], lo[k], sum[k] / count[k], hi[k]);
+    }
+    if (n < 2)
+        printf("  only one CPU: no pairs to measure\n");
+
+    placement_t *def = placement_default();
+    int cpu0 = placement_cpu(def, 0), cpu1 = placement_cpu(def, 1);
+    printf("False sharing, 2 threads x %d increments", FALSE_SHARING_OPS);
+    if (cpu0 < 0)
+        printf(" (unpinned):\n");
+    else
+        printf(" (cpus %d and %d):\n", cpu0, cpu1);
+    // Unpinned, the scheduler may put both threads on one CPU; pinned to one CPU they
+    // take turns and never fight over the line. Either way the ratio means nothing.
+    if (cpu0 < 0 || cpu0 == cpu1) {
+        printf("  skipped: needs two threads pinned to different CPUs (set $OSTEP_PLACE)\n");
+        return 0;
+    }
+    double shared_ns = count_ns(&adjacent.a, &adjacent.b);
+    double padded_ns = count_ns(&padded[0].v, &padded[1].v);
+    printf("  same line:      %6.2f ns per increment\n", shared_ns);
+    printf("  separate lines: %6.2f ns per increment\n", padded_ns);
+    printf("  false sharing costs %.1fx\n", shared_ns / padded_ns);
+    return 0;
+}
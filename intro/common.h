@@ -4,18 +4,16 @@
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include "../concurrency/timing.h"
 
+// Seconds on CLOCK_MONOTONIC, read from the calibrated TSC where there is one
 double GetTime() {
-    struct timeval t;
-    int rc = gettimeofday(&t, NULL);
-    assert(rc == 0);
-    return (double) t.tv_sec + (double) t.tv_usec/1e6;
+    return timing_now();
 }
 
+// Busy-wait howlong seconds
 void Spin(int howlong) {
-    double t = GetTime();
-    while ((GetTime() - t) < (double) howlong)
-	; // do nothing in loop
+    timing_spin_ns((uint64_t) howlong * 1000000000ULL);
 }
 
 #endif // __common_h__
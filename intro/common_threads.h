@@ -12,17 +12,28 @@
 #define Pthread_create(thread, attr, start_routine, arg) assert(pthread_create(thread, attr, start_routine, arg) == 0);
 #define Pthread_join(thread, value_ptr)                  assert(pthread_join(thread, value_ptr) == 0);
 
+// -DLOCK_PROFILE: per-lock, per-call-site contention report at exit (see lock_profile.h)
+#ifdef LOCK_PROFILE
+#include "lock_profile.h"
+#define Pthread_mutex_lock(m)                            assert(lp_mutex_lock(m, __FILE__, __LINE__) == 0);
+#define Pthread_mutex_unlock(m)                          assert(lp_mutex_unlock(m) == 0);
+#define Pthread_cond_wait(cond, mutex)                   assert(lp_cond_wait(cond, mutex) == 0);
+#define Mutex_lock(m)                                    assert(lp_mutex_lock(m, __FILE__, __LINE__) == 0);
+#define Mutex_unlock(m)                                  assert(lp_mutex_unlock(m) == 0);
+#define Cond_wait(cond, mutex)                           assert(lp_cond_wait(cond, mutex) == 0);
+#else
 #define Pthread_mutex_lock(m)                            assert(pthread_mutex_lock(m) == 0);
 #define Pthread_mutex_unlock(m)                          assert(pthread_mutex_unlock(m) == 0);
-#define Pthread_cond_signal(cond)                        assert(pthread_cond_signal(cond) == 0);
 #define Pthread_cond_wait(cond, mutex)                   assert(pthread_cond_wait(cond, mutex) == 0);
-
-#define Mutex_init(m)                                    assert(pthread_mutex_init(m, NULL) == 0);
 #define Mutex_lock(m)                                    assert(pthread_mutex_lock(m) == 0);
 #define Mutex_unlock(m)                                  assert(pthread_mutex_unlock(m) == 0);
+#define Cond_wait(cond, mutex)                           assert(pthread_cond_wait(cond, mutex) == 0);
+#endif // LOCK_PROFILE
+
+#define Pthread_cond_signal(cond)                        assert(pthread_cond_signal(cond) == 0);
+#define Mutex_init(m)                                    assert(pthread_mutex_init(m, NULL) == 0);
 #define Cond_init(cond)                                  assert(pthread_cond_init(cond, NULL) == 0);
 #define Cond_signal(cond)                                assert(pthread_cond_signal(cond) == 0);
-#define Cond_wait(cond, mutex)                           assert(pthread_cond_wait(cond, mutex) == 0);
 
 #ifdef __linux__
 #define Sem_init(sem, value)                             assert(sem_init(sem, 0, value) == 0);
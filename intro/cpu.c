@@ -1,21 +1,314 @@
+// Scheduler fairness and wakeup latency
+//
+// cpu <string> is the CPU-virtualization demo: spin a second, print the string,
+// forever. Start several and watch them share the CPU.
+//
+// With options it measures that sharing. Each worker is one thread:
+//   spin     CPU-bound loop; reports its CPU time and share of the wall clock
+//   sleep    wakes every period on an absolute CLOCK_MONOTONIC deadline and records
+//            how late it woke (cyclictest-style), into a histogram
+// under a scheduling policy and priority:
+//   other, batch, idle    prio is the nice value (idle ignores it)
+//   fifo, rr              prio is the real-time priority 1-99, needs CAP_SYS_NICE
+// A policy or priority the kernel refuses (negative nice, real-time without
+// permission) falls back to other/0, and the worker is marked with '*'.
+//
+// All workers are pinned to one CPU (default placement thread 0's, -c -1 to not
+// pin) so they really compete. For the CFS spinners, "expected" is the share their
+// weights give them (the kernel's sched_prio_to_weight: nice 0 = 1024, idle = 3).
+// A fifo/rr spinner owns its CPU except for real-time throttling
+// (sched_rt_runtime_us, 95% by default), so expect everything else to starve.
+//
+// usage: cpu <string>
+//        cpu -t seconds [-p period_us] [-c cpu] [-v] [kind[:policy[:prio[:count]]] ...]
+// -v also prints each sleeper's latency histogram as CSV (label,bucket_high_ns,count,cumulative).
+// With no workers: spin:other:0:2 spin:other:5 spin:batch:0 sleep:other:0 sleep:fifo:50
+
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
 #include <assert.h>
-#include "common.h" 
+#include "common.h"
+#include "common_threads.h"
+#include "../concurrency/placement.h"
+#include "../concurrency/histogram.h"
+
+#define MAX_WORKERS 64
+#define DEFAULT_PERIOD_US 1000
+
+typedef struct
+{
+    // Spec
+    int sleeper;            // 0: CPU-bound spinner, 1: periodic sleeper
+    int policy;
+    int prio;               // nice for other/batch/idle, priority for fifo/rr
+    char label[32];
+
+    // Results
+    int applied;            // 0: refused, ran as other/0
+    double cpu_seconds;
+    long loops;             // Spinner iterations or sleeper wakeups
+    histogram_t late;       // Sleepers: ns past the deadline
+    pthread_t thread;
+} worker_t;
+
+worker_t workers[MAX_WORKERS];
+int num_workers = 0;
+long period_ns = DEFAULT_PERIOD_US * 1000L;
+atomic_int ready, go, stop;
+
+const struct { const char *name; int policy; } policies[] = {
+    { "other", SCHED_OTHER }, { "batch", SCHED_BATCH }, { "idle", SCHED_IDLE },
+    { "fifo", SCHED_FIFO }, { "rr", SCHED_RR },
+};
+
+int is_rt(int policy) {
+    return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+const char *policy_name(int policy) {
+    for (unsigned i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (policies[i].policy == policy)
+            return policies[i].name;
+    }
+    return "?";
+}
+
+// The kernel's sched_prio_to_weight (kernel/sched/core.c), indexed by nice + 20
+const int prio_to_weight[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+
+// CFS weight of a worker; refused workers ran as other/0
+double cfs_weight(worker_t *w) {
+    if (!w->applied || w->policy == SCHED_OTHER || w->policy == SCHED_BATCH) {
+        int nice = w->applied ? w->prio : 0;
+        nice = nice < -20 ? -20 : nice > 19 ? 19 : nice;    // setpriority() clamps the same way
+        return prio_to_weight[nice + 20];
+    }
+    return w->policy == SCHED_IDLE ? 3.0 : 0.0;
+}
+
+// Run from the worker itself: policy and nice are per thread on Linux
+int apply_policy(worker_t *w) {
+    struct sched_param sp = { .sched_priority = is_rt(w->policy) ? w->prio : 0 };
+    if (pthread_setschedparam(pthread_self(), w->policy, &sp) != 0)
+        return 0;
+    if (!is_rt(w->policy) && w->policy != SCHED_IDLE && setpriority(PRIO_PROCESS, gettid(), w->prio) != 0) {
+        sp.sched_priority = 0;
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+        return 0;
+    }
+    return 1;
+}
+
+double thread_cpu_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void *worker(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    w->applied = apply_policy(w);
+    hist_init(&w->late);
+
+    atomic_fetch_add(&ready, 1);
+    while (!atomic_load(&go))
+        sched_yield();
 
-int 
+    double cpu = thread_cpu_seconds();
+    if (!w->sleeper) {
+        while (!atomic_load_explicit(&stop, memory_order_relaxed))
+            w->loops++;
+    } else {
+        struct timespec next;
+        clock_gettime(CLOCK_MONOTONIC, &next);
+        while (!atomic_load(&stop)) {
+            next.tv_nsec += period_ns;
+            while (next.tv_nsec >= 1000000000L) {
+                next.tv_nsec -= 1000000000L;
+                next.tv_sec++;
+            }
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR)
+                ;
+            uint64_t now = timing_mono_ns();
+            uint64_t deadline = (uint64_t)next.tv_sec * 1000000000ULL + next.tv_nsec;
+            hist_record(&w->late, now > deadline ? now - deadline : 0);
+            w->loops++;
+        }
+    }
+    w->cpu_seconds = thread_cpu_seconds() - cpu;
+    return NULL;
+}
+
+// kind[:policy[:prio[:count]]]
+int add_workers(const char *spec) {
+    char buf[64], *fields[4] = { NULL, "other", "0", "1" };
+    int n = 0;
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *tok = strtok(buf, ":"); tok != NULL && n < 4; tok = strtok(NULL, ":"))
+        fields[n++] = tok;
+
+    worker_t w = { 0 };
+    if (strcmp(fields[0], "spin") == 0)
+        w.sleeper = 0;
+    else if (strcmp(fields[0], "sleep") == 0)
+        w.sleeper = 1;
+    else
+        return -1;
+    w.policy = -1;
+    for (unsigned i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        if (strcmp(fields[1], policies[i].name) == 0)
+            w.policy = policies[i].policy;
+    }
+    w.prio = atoi(fields[2]);
+    int count = atoi(fields[3]);
+    if (w.policy < 0 || count < 1 || (is_rt(w.policy) && (w.prio < 1 || w.prio > 99)))
+        return -1;
+    snprintf(w.label, sizeof(w.label), "%s:%s:%d", fields[0], fields[1], w.prio);
+    for (int i = 0; i < count; i++) {
+        if (num_workers == MAX_WORKERS)
+            return -1;
+        workers[num_workers++] = w;
+    }
+    return 0;
+}
+
+void usage(void) {
+    fprintf(stderr, "usage: cpu <string>\n"
+                    "       cpu -t seconds [-p period_us] [-c cpu] [-v] [kind[:policy[:prio[:count]]] ...]\n"
+                    "       kind: spin | sleep   policy: other | batch | idle | fifo | rr\n");
+    exit(1);
+}
+
+int
 main(int argc, char *argv[])
 {
-    if (argc != 2) {
-        fprintf(stderr, "usage: cpu <string>\n");
-        exit(1);
+    if (argc != 2 && (argc < 2 || argv[1][0] != '-'))
+        usage();
+    if (argv[1][0] != '-') {
+        char *str = argv[1];
+        while (1) {
+            Spin(1);
+            printf("%s\n", str);
+        }
+    }
+
+    double seconds = 0;
+    int cpu = placement_cpu(placement_default(), 0), verbose = 0, opt;
+    while ((opt = getopt(argc, argv, "t:p:c:v")) != -1) {
+        switch (opt) {
+        case 't': seconds = atof(optarg); break;
+        case 'p': period_ns = atol(optarg) * 1000L; break;
+        case 'c': cpu = atoi(optarg); break;
+        case 'v': verbose = 1; break;
+        default: usage();
+        }
+    }
+    if (seconds <= 0 || period_ns <= 0)
+        usage();
+    for (int i = optind; i < argc; i++) {
+        if (add_workers(argv[i]) != 0) {
+            fprintf(stderr, "bad worker '%s'\n", argv[i]);
+            usage();
+        }
+    }
+    if (num_workers == 0) {
+        const char *defaults[] = { "spin:other:0:2", "spin:other:5", "spin:batch:0", "sleep:other:0", "sleep:fifo:50" };
+        for (unsigned i = 0; i < sizeof(defaults) / sizeof(defaults[0]); i++)
+            add_workers(defaults[i]);
+    }
+    mlockall(MCL_CURRENT | MCL_FUTURE);    // Like cyclictest: no page faults in the sleepers; fine if refused
+
+    for (int i = 0; i < num_workers; i++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (cpu >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+        }
+        Pthread_create(&workers[i].thread, &attr, worker, &workers[i]);
+        pthread_attr_destroy(&attr);
+    }
+    while (atomic_load(&ready) < num_workers)
+        sched_yield();
+
+    double start = GetTime();
+    atomic_store(&go, 1);
+    struct timespec run = { (time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9) };
+    nanosleep(&run, NULL);
+    atomic_store(&stop, 1);
+    double wall = GetTime() - start;
+    for (int i = 0; i < num_workers; i++)
+        Pthread_join(workers[i].thread, NULL);
+
+    // Expected shares only mean something when the spinners share one CPU with no real-time spinner
+    double total_weight = 0;
+    int rt_spinner = 0;
+    for (int i = 0; i < num_workers; i++) {
+        if (!workers[i].sleeper) {
+            total_weight += cfs_weight(&workers[i]);
+            rt_spinner |= workers[i].applied && is_rt(workers[i].policy);
+        }
+    }
+
+    printf("%d workers for %.2f s, %s, sleepers wake every %ld us\n", num_workers, wall,
+           cpu >= 0 ? "all on one CPU" : "not pinned", period_ns / 1000);
+    if (cpu >= 0)
+        printf("CPU: %d\n", cpu);
+    printf("  %-18s %7s %6s %8s %10s %8s %8s %8s %8s %8s\n", "worker", "cpu_s", "share", "expected",
+           "wakeups", "min_us", "avg_us", "p99_us", "p99.9_us", "max_us");
+    for (int i = 0; i < num_workers; i++) {
+        worker_t *w = &workers[i];
+        char label[40];
+        snprintf(label, sizeof(label), "%s%s", w->label, w->applied ? "" : "*");
+        printf("  %-18s %7.3f %5.1f%%", label, w->cpu_seconds, w->cpu_seconds / wall * 100);
+        if (!w->sleeper && cpu >= 0 && !rt_spinner && total_weight > 0)
+            printf(" %7.1f%%", cfs_weight(w) / total_weight * 100);
+        else
+            printf(" %8s", "-");
+        if (!w->sleeper) {
+            printf(" %10s\n", "-");
+            continue;
+        }
+        histogram_t *h = &w->late;
+        printf(" %10ld %8.1f %8.1f %8.1f %8.1f %8.1f\n", w->loops,
+               h->count ? h->min / 1e3 : 0.0, h->count ? (double)h->sum / h->count / 1e3 : 0.0,
+               hist_percentile(h, 99) / 1e3, hist_percentile(h, 99.9) / 1e3, h->max / 1e3);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (!workers[i].applied) {
+            printf("  * policy or priority refused (needs CAP_SYS_NICE / RLIMIT_RTPRIO): ran as other:0\n");
+            break;
+        }
     }
 
-    char *str = argv[1];
-    while (1) {
-        Spin(1);
-        printf("%s\n", str);
+    if (verbose) {
+        printf("label,bucket_high_ns,count,cumulative\n");
+        for (int i = 0; i < num_workers; i++) {
+            char label[48];
+            snprintf(label, sizeof(label), "%d:%s", i, workers[i].label);
+            if (workers[i].sleeper)
+                hist_dump_csv(&workers[i].late, stdout, label);
+        }
     }
     return 0;
 }
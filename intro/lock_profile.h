@@ -0,0 +1,215 @@
+#ifndef __lock_profile_h__
+#define __lock_profile_h__
+
+// Lock contention profiler behind the Mutex_lock/Pthread_mutex_lock wrappers.
+// Build with -DLOCK_PROFILE; without it common_threads.h never includes this file.
+//
+// Per lock and per call site (__FILE__:__LINE__ of the lock call) it records
+// acquisitions, how many found the lock taken, time spent waiting and time held.
+// Each thread counts in its own table (no shared writes on the lock path); the
+// tables are merged at exit and printed to stderr, worst total wait first.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include "../concurrency/timing.h"
+
+#define LP_SITES 256          // Per-thread table size (power of two)
+#define LP_MAX_HELD 16        // Locks one thread may hold at once
+#define LP_REPORT_TOP 20
+
+typedef struct
+{
+    pthread_mutex_t *lock;    // NULL = empty slot
+    const char *file;
+    int line;
+    unsigned long acquires;
+    unsigned long contended;
+    unsigned long long wait_ns;
+    unsigned long long hold_ns;
+} lp_site_t;
+
+typedef struct lp_table
+{
+    lp_site_t sites[LP_SITES];
+    unsigned long overflow;   // Acquisitions that found the table full
+    struct lp_table *next;
+    // Locks currently held by this thread: which site took them and when
+    struct { pthread_mutex_t *lock; lp_site_t *site; unsigned long long since; } held[LP_MAX_HELD];
+    int num_held;
+} lp_table_t;
+
+static lp_table_t *lp_tables = NULL;    // Every thread's table, kept after the thread exits
+static pthread_mutex_t lp_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t lp_once = PTHREAD_ONCE_INIT;
+static __thread lp_table_t *lp_self = NULL;
+
+static inline unsigned long long lp_now_ns(void) {
+    return timing_ns();
+}
+
+static int lp_cmp_wait(const void *a, const void *b) {
+    const lp_site_t *x = a, *y = b;
+    return x->wait_ns < y->wait_ns ? 1 : x->wait_ns > y->wait_ns ? -1 : 0;
+}
+
+// Merge all threads' entries for the same (lock, site) and print the top ones
+static void lp_report(void) {
+    int cap = 0, n = 0;
+    lp_site_t *all = NULL;
+    unsigned long overflow = 0;
+
+    pthread_mutex_lock(&lp_tables_lock);
+    for (lp_table_t *t = lp_tables; t != NULL; t = t->next) {
+        overflow += t->overflow;
+        for (int i = 0; i < LP_SITES; i++) {
+            lp_site_t *s = &t->sites[i];
+            if (s->lock == NULL)
+                continue;
+            int j;
+            for (j = 0; j < n; j++) {
+                if (all[j].lock == s->lock && all[j].line == s->line && strcmp(all[j].file, s->file) == 0)
+                    break;
+            }
+            if (j == n) {
+                if (n == cap) {
+                    cap = cap ? cap * 2 : 64;
+                    all = realloc(all, cap * sizeof(lp_site_t));
+                }
+                all[n++] = *s;
+                continue;
+            }
+            all[j].acquires += s->acquires;
+            all[j].contended += s->contended;
+            all[j].wait_ns += s->wait_ns;
+            all[j].hold_ns += s->hold_ns;
+        }
+    }
+    pthread_mutex_unlock(&lp_tables_lock);
+
+    qsort(all, n, sizeof(lp_site_t), lp_cmp_wait);
+    fprintf(stderr, "\n--- lock profile (top %d by total wait) ---\n", LP_REPORT_TOP);
+    fprintf(stderr, "%-28s %-14s %10s %9s %12s %12s %12s\n",
+            "site", "lock", "acquires", "contended", "wait_ms", "avg_wait_ns", "avg_hold_ns");
+    for (int i = 0; i < n && i < LP_REPORT_TOP; i++) {
+        lp_site_t *s = &all[i];
+        char site[64];
+        const char *base = strrchr(s->file, '/');
+        snprintf(site, sizeof(site), "%s:%d", base ? base + 1 : s->file, s->line);
+        fprintf(stderr, "%-28s %-14p %10lu %8.1f%% %12.3f %12.0f %12.0f\n", site, (void *)s->lock,
+                s->acquires, 100.0 * s->contended / s->acquires, s->wait_ns / 1e6,
+                (double)s->wait_ns / s->acquires, (double)s->hold_ns / s->acquires);
+    }
+    if (overflow > 0)
+        fprintf(stderr, "(%lu acquisitions not profiled: more than %d sites per thread)\n", overflow, LP_SITES);
+    free(all);
+}
+
+static void lp_register_atexit(void) {
+    atexit(lp_report);
+}
+
+// First lock on this thread: make its table and link it in (cold path)
+static inline lp_table_t *lp_table(void) {
+    if (lp_self == NULL) {
+        pthread_once(&lp_once, lp_register_atexit);
+        lp_self = calloc(1, sizeof(lp_table_t));
+        pthread_mutex_lock(&lp_tables_lock);
+        lp_self->next = lp_tables;
+        lp_tables = lp_self;
+        pthread_mutex_unlock(&lp_tables_lock);
+    }
+    return lp_self;
+}
+
+static inline lp_site_t *lp_site(lp_table_t *t, pthread_mutex_t *m, const char *file, int line) {
+    unsigned h = (unsigned)(((unsigned long)m >> 4) ^ ((unsigned long)file >> 3) ^ (unsigned)line * 2654435761u);
+    for (int probe = 0; probe < LP_SITES; probe++) {
+        lp_site_t *s = &t->sites[(h + probe) & (LP_SITES - 1)];
+        if (s->lock == m && s->line == line && s->file == file)
+            return s;
+        if (s->lock == NULL) {
+            s->lock = m;
+            s->file = file;
+            s->line = line;
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static inline int lp_mutex_lock(pthread_mutex_t *m, const char *file, int line) {
+    lp_table_t *t = lp_table();
+    lp_site_t *s = lp_site(t, m, file, line);
+    unsigned long long start = lp_now_ns();
+
+    // Try first: an uncontended acquire costs no extra wait bookkeeping
+    int rc = pthread_mutex_trylock(m);
+    int contended = rc == EBUSY;
+    if (contended)
+        rc = pthread_mutex_lock(m);
+    if (rc != 0)
+        return rc;
+
+    unsigned long long now = contended ? lp_now_ns() : start;
+    if (s == NULL) {
+        t->overflow++;
+    } else {
+        s->acquires++;
+        s->contended += contended;
+        s->wait_ns += now - start;
+    }
+    if (t->num_held < LP_MAX_HELD) {
+        t->held[t->num_held].lock = m;
+        t->held[t->num_held].site = s;
+        t->held[t->num_held].since = now;
+        t->num_held++;
+    }
+    return 0;
+}
+
+// Hold time goes to the site that acquired the lock, wherever it is released
+static inline void lp_end_hold(pthread_mutex_t *m) {
+    lp_table_t *t = lp_table();
+    for (int i = t->num_held - 1; i >= 0; i--) {
+        if (t->held[i].lock != m)
+            continue;
+        if (t->held[i].site != NULL)
+            t->held[i].site->hold_ns += lp_now_ns() - t->held[i].since;
+        t->held[i] = t->held[--t->num_held];
+        return;
+    }
+}
+
+static inline int lp_mutex_unlock(pthread_mutex_t *m) {
+    lp_end_hold(m);
+    return pthread_mutex_unlock(m);
+}
+
+// The wait gives the mutex up: stop the hold clock, restart it once we have it back
+static inline int lp_cond_wait(pthread_cond_t *c, pthread_mutex_t *m) {
+    lp_table_t *t = lp_table();
+    lp_site_t *s = NULL;
+    int tracked = 0;
+    for (int i = t->num_held - 1; i >= 0 && !tracked; i--) {
+        if (t->held[i].lock == m) {
+            s = t->held[i].site;
+            tracked = 1;
+        }
+    }
+    lp_end_hold(m);
+    int rc = pthread_cond_wait(c, m);
+    if (tracked && t->num_held < LP_MAX_HELD) {
+        t->held[t->num_held].lock = m;
+        t->held[t->num_held].site = s;
+        t->held[t->num_held].since = lp_now_ns();
+        t->num_held++;
+    }
+    return rc;
+}
+
+#endif // __lock_profile_h__
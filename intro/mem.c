@@ -1,18 +1,393 @@
+// Memory characterization
+//
+// With no arguments this is the address-space demo: print where malloc put p,
+// then bump *p once a second. Run two copies and both report the same address.
+//
+// With a test name it measures the machine's memory hierarchy:
+//   latency   dependent pointer chase through a random cyclic list of cache lines,
+//             working sets from 4 KB to ~4x the last-level cache (L1 ... DRAM)
+//   stream    STREAM copy/scale/add/triad bandwidth at 1, 2, 4, ... threads; each
+//             thread first-touches its own slice, placed per $OSTEP_PLACE
+//   tlb       one line per page over a growing span, 4 KB pages (MADV_NOHUGEPAGE)
+//             vs. transparent huge pages (MADV_HUGEPAGE): only the TLB reach differs
+//   numa      chase latency and read bandwidth from every node's CPUs to every
+//             node's memory (memory placed by first touch)
+//
+// usage: mem [latency|stream|tlb|numa|all] [max_threads]
+
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "common.h"
+#include "../concurrency/bench.h"
 
-int main(int argc, char *argv[])
-{
+#define LINE 64
+#define PAGE 4096
+#define HUGE_PAGE (2UL << 20)
+#define CHASE_LOADS (2L << 20)          // Loads timed per working-set size
+#define CHASE_MIN_BYTES (4UL << 10)
+#define CHASE_MIN_MAX (64UL << 20)      // Largest working set is at least this
+#define TLB_MAX_PAGES (128L << 10)      // 512 MB span
+#define STREAM_MIN_ELEMS (2L << 20)
+#define STREAM_REPEATS 5
+#define NUMA_BYTES (256UL << 20)
+
+void *volatile chase_sink;
+volatile uint64_t read_sink;
+
+// Address-space demo (the original mem.c)
+void demo(void) {
     int *p = malloc(sizeof(int)); // assign memory
     assert(p != NULL);
-    printf("(%d) memory address of p: %08x\n", getpid(), (unsigned) p); // print memory addr
+    printf("(%d) memory address of p: %p\n", getpid(), (void *) p); // print memory addr
     *p = 0;
     while (1) {
         Spin(1);
         *p = *p + 1;
         printf("(%d) p: %d\n", getpid(), *p);
     }
+}
+
+// Anonymous memory aligned to a huge page, so THP can back it.
+// advice: MADV_HUGEPAGE, MADV_NOHUGEPAGE or -1 for the system default.
+void *region_alloc(size_t bytes, int advice) {
+    bytes = (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+    char *raw = mmap(NULL, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(raw != MAP_FAILED);
+    char *p = (char *)(((uintptr_t)raw + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+    if (p > raw)
+        munmap(raw, p - raw);
+    munmap(p + bytes, raw + HUGE_PAGE - p);
+    if (advice >= 0)
+        madvise(p, bytes, advice);
+    return p;
+}
+
+void region_free(void *p, size_t bytes) {
+    munmap(p, (bytes + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+}
+
+// AnonHugePages of this process, to tell whether MADV_HUGEPAGE was honoured
+long anon_huge_kb(void) {
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    char line[256];
+    long kb = -1;
+    if (f == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(f);
+    return kb;
+}
+
+uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+// Link n nodes, node i at base + i * stride + offset(i), into one random cycle
+// (Sattolo's shuffle), so every load depends on the last and the prefetcher can't help
+void *chase_build(char *base, long n, long stride, int spread) {
+    uint32_t *order = malloc(n * sizeof(uint32_t));
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    assert(order != NULL);
+    for (long i = 0; i < n; i++)
+        order[i] = i;
+    for (long i = n - 1; i > 0; i--) {
+        long j = xorshift(&rng) % i;
+        uint32_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    // spread: move each node to a different line of its page, so one-per-page
+    // nodes don't all land in the same cache set
+#define NODE(i) ((void **)(base + (long)(i) * stride + (spread ? ((i) % (PAGE / LINE)) * LINE : 0)))
+    for (long i = 0; i < n; i++)
+        *NODE(order[i]) = NODE(order[(i + 1) % n]);
+    void *start = NODE(order[0]);
+#undef NODE
+    free(order);
+    return start;
+}
+
+// ns per dependent load
+double chase_ns(void *start, long warm, long loads) {
+    void **p = start;
+    for (long i = 0; i < warm; i++)
+        p = *p;
+    uint64_t t0 = timing_start();
+    for (long i = 0; i < loads; i += 8) {
+        p = *p; p = *p; p = *p; p = *p;
+        p = *p; p = *p; p = *p; p = *p;
+    }
+    uint64_t t1 = timing_stop();
+    chase_sink = p;
+    return timing_elapsed_ns(t0, t1) / loads;
+}
+
+// Sequential read bandwidth, MB/s
+double read_mbs(uint64_t *a, long n) {
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    double t = timing_now();
+    for (long i = 0; i < n; i += 4) {
+        s0 += a[i];
+        s1 += a[i + 1];
+        s2 += a[i + 2];
+        s3 += a[i + 3];
+    }
+    t = timing_now() - t;
+    read_sink = s0 + s1 + s2 + s3;
+    return n * sizeof(uint64_t) / t / 1e6;
+}
+
+long cache_size(int name, long fallback) {
+    long v = sysconf(name);
+    return v > 0 ? v : fallback;
+}
+
+long llc_bytes(void) {
+    long l3 = cache_size(_SC_LEVEL3_CACHE_SIZE, 0);
+    return l3 > 0 ? l3 : cache_size(_SC_LEVEL2_CACHE_SIZE, 1L << 20);
+}
+
+void test_latency(void) {
+    long l1 = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32L << 10);
+    long l2 = cache_size(_SC_LEVEL2_CACHE_SIZE, 1L << 20);
+    long l3 = cache_size(_SC_LEVEL3_CACHE_SIZE, 0);
+    unsigned long max = CHASE_MIN_MAX;
+    while (max < 4UL * llc_bytes())
+        max *= 2;
+
+    printf("Pointer-chase latency (L1 %ld KB, L2 %ld KB, L3 %ld KB):\n", l1 >> 10, l2 >> 10, l3 >> 10);
+    printf("  %10s  %-5s %8s %8s\n", "size", "level", "ns", "cycles");
+    char *mem = region_alloc(max, -1);
+    memset(mem, 0, max);
+    for (unsigned long bytes = CHASE_MIN_BYTES; bytes <= max; bytes *= 2) {
+        long n = bytes / LINE;
+        void *start = chase_build(mem, n, LINE, 0);
+        double ns = chase_ns(start, n < CHASE_LOADS ? n : CHASE_LOADS, CHASE_LOADS);
+        const char *level = (long)bytes <= l1 ? "L1" : (long)bytes <= l2 ? "L2"
+                          : (long)bytes <= l3 ? "L3" : "DRAM";
+        printf("  %7lu KB  %-5s %8.2f %8.1f\n", bytes >> 10, level, ns, ns / timing_init()->ns_per_cycle);
+        fflush(stdout);
+    }
+    region_free(mem, max);
+}
+
+// STREAM kernels over this thread's slice
+typedef struct
+{
+    double *a, *b, *c;
+    long lo, hi;
+    int kernel;
+} stream_arg_t;
+
+enum { STREAM_INIT, STREAM_COPY, STREAM_SCALE, STREAM_ADD, STREAM_TRIAD };
+
+void* stream_worker(void* arg) {
+    stream_arg_t *s = (stream_arg_t *)arg;
+    double *a = s->a, *b = s->b, *c = s->c;
+    const double q = 3.0;
+    switch (s->kernel) {
+    case STREAM_INIT:    // First touch: pages go to this thread's node
+        for (long i = s->lo; i < s->hi; i++) {
+            a[i] = 1.0;
+            b[i] = 2.0;
+            c[i] = 0.0;
+        }
+        break;
+    case STREAM_COPY:
+        for (long i = s->lo; i < s->hi; i++)
+            c[i] = a[i];
+        break;
+    case STREAM_SCALE:
+        for (long i = s->lo; i < s->hi; i++)
+            b[i] = q * c[i];
+        break;
+    case STREAM_ADD:
+        for (long i = s->lo; i < s->hi; i++)
+            c[i] = a[i] + b[i];
+        break;
+    case STREAM_TRIAD:
+        for (long i = s->lo; i < s->hi; i++)
+            a[i] = b[i] + q * c[i];
+        break;
+    }
+    return NULL;
+}
+
+// Best-of-STREAM_REPEATS seconds for one kernel
+double stream_run(stream_arg_t *args, int nthreads, int kernel, int repeats) {
+    double best = 0;
+    for (int i = 0; i < nthreads; i++)
+        args[i].kernel = kernel;
+    for (int r = 0; r < repeats; r++) {
+        bench_t b = { .nthreads = nthreads, .worker = stream_worker, .args = args,
+                      .arg_size = sizeof(args[0]), .ops_per_thread = 1 };
+        bench_run(&b);
+        best = r == 0 || b.seconds < best ? b.seconds : best;
+    }
+    return best;
+}
+
+void test_stream(int max_threads) {
+    // STREAM's rule: each array at least 4x the last-level cache
+    long n = 4 * llc_bytes() / sizeof(double);
+    n = n > STREAM_MIN_ELEMS ? n : STREAM_MIN_ELEMS;
+    size_t bytes = n * sizeof(double);
+    const int words[] = { 2, 2, 3, 3 };    // Doubles moved per element
+
+    printf("STREAM bandwidth, MB/s (3 arrays of %zu MB, best of %d):\n", bytes >> 20, STREAM_REPEATS);
+    printf("  %7s %10s %10s %10s %10s\n", "threads", "copy", "scale", "add", "triad");
+    for (int nthreads = 1; ; nthreads = nthreads * 2 < max_threads ? nthreads * 2 : max_threads) {
+        stream_arg_t *args = malloc(nthreads * sizeof(stream_arg_t));
+        double *a = region_alloc(bytes, -1), *b = region_alloc(bytes, -1), *c = region_alloc(bytes, -1);
+        for (int i = 0; i < nthreads; i++) {
+            args[i] = (stream_arg_t){ a, b, c, n * i / nthreads, n * (i + 1) / nthreads, 0 };
+        }
+        stream_run(args, nthreads, STREAM_INIT, 1);
+
+        printf("  %7d", nthreads);
+        for (int k = 0; k < 4; k++) {
+            double t = stream_run(args, nthreads, STREAM_COPY + k, STREAM_REPEATS);
+            printf(" %10.0f", words[k] * bytes / t / 1e6);
+        }
+        printf("\n");
+        fflush(stdout);
+
+        region_free(a, bytes);
+        region_free(b, bytes);
+        region_free(c, bytes);
+        free(args);
+        if (nthreads == max_threads)
+            break;
+    }
+}
+
+void test_tlb(void) {
+    size_t span = TLB_MAX_PAGES * PAGE;
+    printf("TLB reach: one line per 4 KB page, %ld loads per cell\n", CHASE_LOADS);
+    char *small = region_alloc(span, MADV_NOHUGEPAGE);
+    memset(small, 0, span);
+    long before = anon_huge_kb();
+    char *huge = region_alloc(span, MADV_HUGEPAGE);
+    memset(huge, 0, span);
+    long huge_kb = anon_huge_kb() - before;
+    if (before < 0 || huge_kb <= 0)
+        printf("  no huge pages granted: check /sys/kernel/mm/transparent_hugepage/enabled\n");
+    else
+        printf("  %ld%% of the MADV_HUGEPAGE span is backed by huge pages\n", huge_kb * 100 / (long)(span >> 10));
+    printf("  %8s %10s %10s %10s\n", "pages", "span", "4K ns", "THP ns");
+
+    for (long pages = 16; pages <= TLB_MAX_PAGES; pages *= 2) {
+        void *s = chase_build(small, pages, PAGE, 1);
+        void *h = chase_build(huge, pages, PAGE, 1);
+        double ns_small = chase_ns(s, pages, CHASE_LOADS);
+        double ns_huge = chase_ns(h, pages, CHASE_LOADS);
+        printf("  %8ld %7ld KB %10.2f %10.2f\n", pages, pages * PAGE >> 10, ns_small, ns_huge);
+        fflush(stdout);
+    }
+    region_free(small, span);
+    region_free(huge, span);
+}
+
+void test_numa(void) {
+    static placement_t topo;
+    int node_cpu[CPU_SETSIZE], nodes[CPU_SETSIZE], num_nodes = 0;
+
+    // Topology regardless of $OSTEP_PLACE: first CPU seen on each node
+    placement_init(&topo, "compact");
+    for (int i = 0; i < topo.num_cpus; i++) {
+        int seen = 0;
+        for (int k = 0; k < num_nodes; k++)
+            seen |= nodes[k] == topo.nodes[i];
+        if (!seen) {
+            nodes[num_nodes] = topo.nodes[i];
+            node_cpu[num_nodes++] = topo.cpus[i];
+        }
+    }
+    printf("NUMA: %d node%s\n", num_nodes, num_nodes == 1 ? "" : "s");
+    if (num_nodes < 2) {
+        printf("  single node, nothing remote to measure\n");
+        return;
+    }
+
+    double lat[num_nodes][num_nodes], bw[num_nodes][num_nodes];
+    long n = NUMA_BYTES / LINE;
+    for (int m = 0; m < num_nodes; m++) {
+        placement_t one;
+        char cpu[16];
+        snprintf(cpu, sizeof(cpu), "%d", node_cpu[m]);
+        placement_init(&one, cpu);
+        placement_pin_self(&one, 0);
+        char *mem = region_alloc(NUMA_BYTES, -1);
+        memset(mem, 0, NUMA_BYTES);    // First touch from node m's CPU
+        void *start = chase_build(mem, n, LINE, 0);
+        for (int c = 0; c < num_nodes; c++) {
+            snprintf(cpu, sizeof(cpu), "%d", node_cpu[c]);
+            placement_init(&one, cpu);
+            placement_pin_self(&one, 0);
+            lat[c][m] = chase_ns(start, CHASE_LOADS, CHASE_LOADS);
+            bw[c][m] = read_mbs((uint64_t *)mem, NUMA_BYTES / sizeof(uint64_t));
+        }
+        region_free(mem, NUMA_BYTES);
+    }
+    placement_unpin_main();
+
+    printf("  latency, ns (row: CPU node, column: memory node)\n  %6s", "");
+    for (int m = 0; m < num_nodes; m++)
+        printf(" %8d", nodes[m]);
+    printf("\n");
+    for (int c = 0; c < num_nodes; c++) {
+        printf("  %6d", nodes[c]);
+        for (int m = 0; m < num_nodes; m++)
+            printf(" %8.1f", lat[c][m]);
+        printf("\n");
+    }
+    printf("  read bandwidth, one thread, MB/s\n  %6s", "");
+    for (int m = 0; m < num_nodes; m++)
+        printf(" %8d", nodes[m]);
+    printf("\n");
+    for (int c = 0; c < num_nodes; c++) {
+        printf("  %6d", nodes[c]);
+        for (int m = 0; m < num_nodes; m++)
+            printf(" %8.0f", bw[c][m]);
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc == 1)
+        demo();
+
+    const char *test = argv[1];
+    int all = strcmp(test, "all") == 0;
+    int max_threads = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_threads < 1 || max_threads > BENCH_MAX_THREADS ||
+        !(all || strcmp(test, "latency") == 0 || strcmp(test, "stream") == 0 ||
+          strcmp(test, "tlb") == 0 || strcmp(test, "numa") == 0)) {
+        fprintf(stderr, "usage: mem [latency|stream|tlb|numa|all] [max_threads]\n");
+        exit(1);
+    }
+
+    printf("Timer: %s\n", timing_source());
+    placement_print(placement_default(), stdout);
+    if (all || strcmp(test, "latency") == 0)
+        test_latency();
+    if (all || strcmp(test, "stream") == 0)
+        test_stream(max_threads);
+    if (all || strcmp(test, "tlb") == 0)
+        test_tlb();
+    if (all || strcmp(test, "numa") == 0)
+        test_numa();
     return 0;
 }
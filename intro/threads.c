@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include "common.h"
 #include "common_threads.h"
+#include "../thread-api/parallel.h"
 
 volatile int counter = 0;
 int loops;
@@ -14,6 +15,22 @@ void *worker(void *arg) {
     return NULL;
 }
 
+// The same 2 * loops increments as a reduction: each worker counts into a
+// private variable, and the per-worker counts are added up at the end
+long count(long lo, long hi, void *arg) {
+    (void)arg;
+    volatile long local = 0;    // volatile like counter: one store per increment
+    long i;
+    for (i = lo; i < hi; i++) {
+        local++;
+    }
+    return local;
+}
+
+long add(long a, long b) {
+    return a + b;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -24,10 +41,25 @@ main(int argc, char *argv[])
     loops = atoi(argv[1]);
     pthread_t p1, p2;
     printf("Initial value : %d\n", counter);
-    Pthread_create(&p1, NULL, worker, NULL); 
+    double t = GetTime();
+    Pthread_create(&p1, NULL, worker, NULL);
     Pthread_create(&p2, NULL, worker, NULL);
     Pthread_join(p1, NULL);
     Pthread_join(p2, NULL);
-    printf("Final value   : %d\n", counter);
+    printf("Final value   : %d (%.3f s)\n", counter, GetTime() - t);
+
+    int workers;
+    double base = 0;
+    for (workers = 1; workers <= 4; workers *= 2) {
+        thread_pool_t pool;
+        pool_init(&pool, workers);
+        t = GetTime();
+        long total = parallel_reduce(&pool, 0, 2L * loops, 0, 0, count, add, NULL);
+        t = GetTime() - t;
+        pool_destroy(&pool);
+        if (workers == 1)
+            base = t;
+        printf("Reduce, %d workers: %ld (%.3f s, %.1fx)\n", workers, total, t, base / t);
+    }
     return 0;
 }
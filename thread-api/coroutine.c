@@ -0,0 +1,249 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Coroutines vs. one pthread per task
+ * thread.c gives every logical task its own kernel thread. Here the same kinds of
+ * handoff run as coroutines on a few workers (coroutine.h):
+ *   - switch cost: two coroutines yielding to each other vs. two pthreads on one CPU
+ *     passing a token through semaphores (each hop a kernel context switch)
+ *   - channel ping-pong between coroutines
+ *   - spawn + finish cost per task, coroutine vs. pthread_create/join
+ *   - many concurrent tasks: NUM_CLIENTS coroutines, each a "connection" that sends
+ *     requests to a few server coroutines over channels and takes a co_mutex
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
+#include "coroutine.h"
+#include "../concurrency/timing.h"
+
+#define SWITCHES 1000000
+#define PINGPONGS 200000
+#define SPAWNS 100000
+#define SPAWN_WAVE 10000         // Live at once: each holds a stack mapping
+#define PTHREAD_SPAWNS 10000
+#define NUM_WORKERS 4
+#define NUM_CLIENTS 20000
+#define REQUESTS_PER_CLIENT 10
+#define NUM_SERVERS 4
+
+// Yield ping-pong: with one worker, each co_yield switches to the other coroutine
+void yielder(void* arg) {
+    (void)arg;
+    for (int i = 0; i < SWITCHES / 2; i++)
+        co_yield();
+}
+
+// Two pthreads on one CPU, alternating through a pair of semaphores
+sem_t sem_a, sem_b;
+
+void* sem_partner(void* arg) {
+    (void)arg;
+    for (int i = 0; i < SWITCHES / 2; i++) {
+        sem_wait(&sem_a);
+        sem_post(&sem_b);
+    }
+    return NULL;
+}
+
+void pin_to_cpu0(void) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(0, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+void* sem_initiator(void* arg) {
+    (void)arg;
+    pin_to_cpu0();
+    for (int i = 0; i < SWITCHES / 2; i++) {
+        sem_post(&sem_a);
+        sem_wait(&sem_b);
+    }
+    return NULL;
+}
+
+void* sem_partner_pinned(void* arg) {
+    pin_to_cpu0();
+    return sem_partner(arg);
+}
+
+// Channel ping-pong
+typedef struct
+{
+    co_chan_t ping;
+    co_chan_t pong;
+} pingpong_t;
+
+void ping(void* arg) {
+    pingpong_t *pp = (pingpong_t *)arg;
+    void *v;
+    for (long i = 0; i < PINGPONGS; i++) {
+        co_chan_send(&pp->ping, (void *)i);
+        co_chan_recv(&pp->pong, &v);
+    }
+}
+
+void pong(void* arg) {
+    pingpong_t *pp = (pingpong_t *)arg;
+    void *v = NULL;
+    for (long i = 0; i < PINGPONGS; i++) {
+        co_chan_recv(&pp->ping, &v);
+        co_chan_send(&pp->pong, v);
+    }
+}
+
+// Spawn cost
+atomic_long spawned_sum;
+
+void tiny_task(void* arg) {
+    atomic_fetch_add_explicit(&spawned_sum, (long)arg, memory_order_relaxed);
+}
+
+void* tiny_thread(void* arg) {
+    atomic_fetch_add_explicit(&spawned_sum, (long)arg, memory_order_relaxed);
+    return NULL;
+}
+
+// Many clients: each sends requests to a server and waits on its own reply channel
+typedef struct
+{
+    long client;
+    co_chan_t *reply;
+} request_t;
+
+co_chan_t server_chans[NUM_SERVERS];
+co_mutex_t stats_lock;
+long requests_served = 0;    // Under stats_lock
+
+void server(void* arg) {
+    co_chan_t *in = (co_chan_t *)arg;
+    void *v;
+    while (co_chan_recv(in, &v)) {
+        request_t *req = (request_t *)v;
+        co_chan_send(req->reply, (void *)(req->client * 2));
+    }
+}
+
+atomic_long clients_left;
+
+void client(void* arg) {
+    long id = (long)arg;
+    co_chan_t reply;
+    co_chan_init(&reply, 1);
+    request_t req = { .client = id, .reply = &reply };
+
+    for (int i = 0; i < REQUESTS_PER_CLIENT; i++) {
+        void *v = NULL;
+        co_chan_send(&server_chans[(id + i) % NUM_SERVERS], &req);
+        co_chan_recv(&reply, &v);
+        assert((long)v == id * 2);
+
+        co_mutex_lock(&stats_lock);
+        requests_served++;
+        co_yield();    // Holding a co_mutex across a yield is allowed: others park on it
+        co_mutex_unlock(&stats_lock);
+    }
+    co_chan_destroy(&reply);
+
+    // Last client out shuts the servers down
+    if (atomic_fetch_sub(&clients_left, 1) == 1) {
+        for (int s = 0; s < NUM_SERVERS; s++)
+            co_chan_close(&server_chans[s]);
+    }
+}
+
+int main() {
+    co_runtime_t rt;
+    double start, elapsed;
+
+    // 1. Switch cost
+    co_runtime_init(&rt, 1);
+    start = timing_now();
+    co_spawn(&rt, yielder, NULL);
+    co_spawn(&rt, yielder, NULL);
+    co_runtime_wait(&rt);
+    elapsed = timing_now() - start;
+    co_runtime_destroy(&rt);
+    printf("Coroutine switch (co_yield, 1 worker): %6.1f ns\n", elapsed * 1e9 / SWITCHES);
+
+    pthread_t t1, t2;
+    sem_init(&sem_a, 0, 0);
+    sem_init(&sem_b, 0, 0);
+    start = timing_now();
+    pthread_create(&t1, NULL, sem_partner_pinned, NULL);
+    pthread_create(&t2, NULL, sem_initiator, NULL);
+    pthread_join(t1, NULL);
+    pthread_join(t2, NULL);
+    elapsed = timing_now() - start;
+    printf("pthread switch (sem_t, same CPU):      %6.1f ns\n", elapsed * 1e9 / SWITCHES);
+
+    // 2. Channel ping-pong
+    pingpong_t pp;
+    co_chan_init(&pp.ping, 1);
+    co_chan_init(&pp.pong, 1);
+    co_runtime_init(&rt, 1);
+    start = timing_now();
+    co_spawn(&rt, ping, &pp);
+    co_spawn(&rt, pong, &pp);
+    co_runtime_wait(&rt);
+    elapsed = timing_now() - start;
+    co_runtime_destroy(&rt);
+    printf("Channel round trip (1 worker):         %6.1f ns\n", elapsed * 1e9 / PINGPONGS);
+    co_chan_destroy(&pp.ping);
+    co_chan_destroy(&pp.pong);
+
+    // 3. Spawn + finish
+    atomic_init(&spawned_sum, 0);
+    co_runtime_init(&rt, NUM_WORKERS);
+    start = timing_now();
+    for (long i = 0; i < SPAWNS; i += SPAWN_WAVE) {
+        for (long j = 0; j < SPAWN_WAVE; j++)
+            co_spawn(&rt, tiny_task, (void *)1);
+        co_runtime_wait(&rt);
+    }
+    elapsed = timing_now() - start;
+    assert(atomic_load(&spawned_sum) == SPAWNS);
+    printf("Coroutine spawn + finish:              %6.0f ns per task\n", elapsed * 1e9 / SPAWNS);
+
+    atomic_store(&spawned_sum, 0);
+    start = timing_now();
+    for (long i = 0; i < PTHREAD_SPAWNS; i++) {
+        pthread_t t;
+        pthread_create(&t, NULL, tiny_thread, (void *)1);
+        pthread_join(t, NULL);
+    }
+    elapsed = timing_now() - start;
+    assert(atomic_load(&spawned_sum) == PTHREAD_SPAWNS);
+    printf("pthread create + join:                 %6.0f ns per task\n", elapsed * 1e9 / PTHREAD_SPAWNS);
+
+    // 4. Many concurrent clients on NUM_WORKERS threads
+    co_mutex_init(&stats_lock);
+    for (int s = 0; s < NUM_SERVERS; s++)
+        co_chan_init(&server_chans[s], 64);
+    atomic_init(&clients_left, NUM_CLIENTS);
+    start = timing_now();
+    for (int s = 0; s < NUM_SERVERS; s++)
+        co_spawn(&rt, server, &server_chans[s]);
+    for (long c = 0; c < NUM_CLIENTS; c++)
+        co_spawn(&rt, client, (void *)c);
+    co_runtime_wait(&rt);
+    elapsed = timing_now() - start;
+    assert(requests_served == (long)NUM_CLIENTS * REQUESTS_PER_CLIENT);
+    printf("%d clients x %d requests on %d workers: %.3f seconds, %.0f requests/second\n",
+           NUM_CLIENTS, REQUESTS_PER_CLIENT, NUM_WORKERS, elapsed, requests_served / elapsed);
+
+    co_runtime_destroy(&rt);
+    for (int s = 0; s < NUM_SERVERS; s++)
+        co_chan_destroy(&server_chans[s]);
+    co_mutex_destroy(&stats_lock);
+    sem_destroy(&sem_a);
+    sem_destroy(&sem_b);
+    return 0;
+}
@@ -0,0 +1,499 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * M:N coroutine runtime
+ * Many coroutines (tens of thousands) run on a few worker pthreads. A coroutine is a
+ * stack plus a saved stack pointer; switching is six register pushes, a stack swap and
+ * six pops, with no syscall (swapcontext would also save the signal mask, a syscall
+ * per switch). Scheduling is cooperative: a coroutine runs until it yields, blocks on
+ * a co_mutex_t or co_chan_t, or returns.
+ *
+ *     co_runtime_t rt;
+ *     co_runtime_init(&rt, 4);
+ *     co_spawn(&rt, fn, arg);       // From main or from inside a coroutine
+ *     co_runtime_wait(&rt);         // Until every coroutine has returned
+ *     co_runtime_destroy(&rt);
+ *
+ * Blocking never holds up the worker: the coroutine is put on the primitive's wait list
+ * and the worker picks up the next runnable one. To close the race with a waker on
+ * another worker, the primitive's guard stays locked until the switch away is complete;
+ * the worker's scheduler loop releases it (co_park).
+ *
+ * Coroutines may migrate between workers, so don't keep a pointer to a __thread variable
+ * across a yield (reading the variable itself is fine in an executable: it is %fs-relative).
+ * Each stack is mmap'ed with a guard page below it, two mappings per live coroutine;
+ * vm.max_map_count (65530 by default) caps that at about 32k live coroutines.
+ * Build with -DCO_NO_GUARD to malloc stacks instead.
+ */
+
+#ifndef __coroutine_h__
+#define __coroutine_h__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if !defined(__x86_64__)
+#include <ucontext.h>
+#endif
+
+#define CO_STACK_SIZE (64 * 1024)
+#define CO_MAX_WORKERS 64
+#define CO_STACK_CACHE 1024    // Finished coroutines' stacks kept for reuse
+
+typedef void (*co_fn_t)(void *arg);
+
+enum { CO_RUNNABLE, CO_YIELDED, CO_BLOCKED, CO_DONE };
+
+typedef struct coroutine
+{
+#if defined(__x86_64__)
+    void *sp;                  // Saved stack pointer while switched out
+#else
+    ucontext_t ctx;
+#endif
+    co_fn_t fn;
+    void *arg;
+    int state;
+    char *stack;
+    struct coroutine *next;    // Run queue or one wait list, never both
+    struct co_runtime *rt;
+} coroutine_t;
+
+typedef struct co_runtime co_runtime_t;
+
+typedef struct
+{
+#if defined(__x86_64__)
+    void *sched_sp;
+#else
+    ucontext_t sched_ctx;
+#endif
+    pthread_mutex_t *release;  // Guard to unlock once the parked coroutine is off its stack
+    co_runtime_t *rt;
+    pthread_t tid;
+} co_worker_t;
+
+struct co_runtime
+{
+    co_worker_t workers[CO_MAX_WORKERS];
+    int num_workers;
+
+    // Run queue, FIFO
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    coroutine_t *head;
+    coroutine_t *tail;
+    int idle;                  // Workers waiting on work
+    int stopping;
+
+    // Coroutines spawned and not yet returned
+    long live;
+    pthread_cond_t all_done;
+
+    char *stack_cache[CO_STACK_CACHE];
+    int num_cached;
+};
+
+static __thread co_worker_t *co_worker_self = NULL;
+static __thread coroutine_t *co_current = NULL;
+
+// Context switch
+#if defined(__x86_64__)
+// Save callee-saved registers on the current stack, store its pointer in *save,
+// then load sp and restore the same registers from there (SysV x86-64 ABI).
+// Defined in top-level asm, out of the compiler's sight: it must assume the call
+// clobbers every caller-saved register, which it does (another coroutine runs).
+// Weak, so the header can be included from several files of one program.
+void co_switch_sp(void **save, void *sp);
+__asm__(
+    ".text\n"
+    ".weak co_switch_sp\n"
+    ".type co_switch_sp, @function\n"
+    "co_switch_sp:\n\t"
+    "pushq %rbp\n\t"
+    "pushq %rbx\n\t"
+    "pushq %r12\n\t"
+    "pushq %r13\n\t"
+    "pushq %r14\n\t"
+    "pushq %r15\n\t"
+    "movq %rsp, (%rdi)\n\t"
+    "movq %rsi, %rsp\n\t"
+    "popq %r15\n\t"
+    "popq %r14\n\t"
+    "popq %r13\n\t"
+    "popq %r12\n\t"
+    "popq %rbx\n\t"
+    "popq %rbp\n\t"
+    "ret\n"
+    ".size co_switch_sp, .-co_switch_sp\n");
+#endif
+
+static void co_entry(void);
+
+static inline char *co_stack_alloc(co_runtime_t *rt) {
+    char *stack = NULL;
+    pthread_mutex_lock(&rt->lock);
+    if (rt->num_cached > 0)
+        stack = rt->stack_cache[--rt->num_cached];
+    pthread_mutex_unlock(&rt->lock);
+    if (stack != NULL)
+        return stack;
+#ifdef CO_NO_GUARD
+    stack = malloc(CO_STACK_SIZE);
+    assert(stack != NULL);
+#else
+    long page = sysconf(_SC_PAGESIZE);
+    char *map = mmap(NULL, CO_STACK_SIZE + page, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    assert(map != MAP_FAILED);
+    mprotect(map, page, PROT_NONE);    // Overflow faults instead of corrupting a neighbour
+    stack = map + page;
+#endif
+    return stack;
+}
+
+static inline void co_stack_unmap(char *stack) {
+#ifdef CO_NO_GUARD
+    free(stack);
+#else
+    long page = sysconf(_SC_PAGESIZE);
+    munmap(stack - page, CO_STACK_SIZE + page);
+#endif
+}
+
+// Called with rt->lock held
+static inline void co_stack_free_locked(co_runtime_t *rt, char *stack) {
+    if (rt->num_cached < CO_STACK_CACHE)
+        rt->stack_cache[rt->num_cached++] = stack;
+    else
+        co_stack_unmap(stack);
+}
+
+// Make co runnable (any thread)
+static inline void co_ready(co_runtime_t *rt, coroutine_t *co) {
+    co->state = CO_RUNNABLE;
+    co->next = NULL;
+    pthread_mutex_lock(&rt->lock);
+    if (rt->tail != NULL)
+        rt->tail->next = co;
+    else
+        rt->head = co;
+    rt->tail = co;
+    if (rt->idle > 0)
+        pthread_cond_signal(&rt->work);
+    pthread_mutex_unlock(&rt->lock);
+}
+
+static inline void co_spawn(co_runtime_t *rt, co_fn_t fn, void *arg) {
+    coroutine_t *co = malloc(sizeof(coroutine_t));
+    assert(co != NULL);
+    co->fn = fn;
+    co->arg = arg;
+    co->rt = rt;
+    co->stack = co_stack_alloc(rt);
+
+#if defined(__x86_64__)
+    // Initial frame for co_switch_sp: six zeroed registers, then co_entry as the
+    // return address. After the ret, rsp is 8 mod 16, as at any function entry.
+    uintptr_t top = ((uintptr_t)co->stack + CO_STACK_SIZE) & ~(uintptr_t)15;
+    void **sp = (void **)top;
+    *--sp = NULL;                  // co_entry's own (unused) return address slot
+    *--sp = (void *)co_entry;
+    for (int i = 0; i < 6; i++)
+        *--sp = NULL;
+    co->sp = sp;
+#else
+    getcontext(&co->ctx);
+    co->ctx.uc_stack.ss_sp = co->stack;
+    co->ctx.uc_stack.ss_size = CO_STACK_SIZE;
+    co->ctx.uc_link = NULL;
+    makecontext(&co->ctx, co_entry, 0);
+#endif
+
+    pthread_mutex_lock(&rt->lock);
+    rt->live++;
+    pthread_mutex_unlock(&rt->lock);
+    co_ready(rt, co);
+}
+
+// From a coroutine back to its worker's scheduler loop
+static inline void co_switch_out(coroutine_t *co) {
+    co_worker_t *w = co_worker_self;
+#if defined(__x86_64__)
+    co_switch_sp(&co->sp, w->sched_sp);
+#else
+    swapcontext(&co->ctx, &w->sched_ctx);
+#endif
+}
+
+static void co_entry(void) {
+    coroutine_t *co = co_current;
+    co->fn(co->arg);
+    co->state = CO_DONE;
+    co_switch_out(co);
+    assert(0);    // A finished coroutine is never resumed
+}
+
+// Let other coroutines run; we go to the back of the run queue
+static inline void co_yield(void) {
+    coroutine_t *co = co_current;
+    assert(co != NULL);
+    co->state = CO_YIELDED;
+    co_switch_out(co);
+}
+
+// Block the current coroutine. The caller holds guard and has put us on a wait list
+// that a waker reaches only under guard; guard is released after we are off our stack.
+static inline void co_park(pthread_mutex_t *guard) {
+    coroutine_t *co = co_current;
+    assert(co != NULL);
+    co->state = CO_BLOCKED;
+    co_worker_self->release = guard;
+    co_switch_out(co);
+}
+
+static void *co_worker_main(void *arg) {
+    co_worker_t *w = (co_worker_t *)arg;
+    co_runtime_t *rt = w->rt;
+    co_worker_self = w;
+
+    while (1) {
+        pthread_mutex_lock(&rt->lock);
+        while (rt->head == NULL && !rt->stopping) {
+            rt->idle++;
+            pthread_cond_wait(&rt->work, &rt->lock);
+            rt->idle--;
+        }
+        coroutine_t *co = rt->head;
+        if (co == NULL) {
+            pthread_mutex_unlock(&rt->lock);
+            break;
+        }
+        rt->head = co->next;
+        if (rt->head == NULL)
+            rt->tail = NULL;
+        pthread_mutex_unlock(&rt->lock);
+
+        co_current = co;
+#if defined(__x86_64__)
+        co_switch_sp(&w->sched_sp, co->sp);
+#else
+        swapcontext(&w->sched_ctx, &co->ctx);
+#endif
+        co_current = NULL;
+
+        // co is off its stack now: finish what it asked for
+        if (co->state == CO_YIELDED) {
+            co_ready(rt, co);
+        } else if (co->state == CO_BLOCKED) {
+            pthread_mutex_unlock(w->release);
+            w->release = NULL;
+        } else if (co->state == CO_DONE) {
+            pthread_mutex_lock(&rt->lock);
+            co_stack_free_locked(rt, co->stack);
+            if (--rt->live == 0)
+                pthread_cond_broadcast(&rt->all_done);
+            pthread_mutex_unlock(&rt->lock);
+            free(co);
+        }
+    }
+    return NULL;
+}
+
+static inline void co_runtime_init(co_runtime_t *rt, int num_workers) {
+    assert(num_workers > 0 && num_workers <= CO_MAX_WORKERS);
+    pthread_mutex_init(&rt->lock, NULL);
+    pthread_cond_init(&rt->work, NULL);
+    pthread_cond_init(&rt->all_done, NULL);
+    rt->head = rt->tail = NULL;
+    rt->idle = 0;
+    rt->stopping = 0;
+    rt->live = 0;
+    rt->num_cached = 0;
+    rt->num_workers = num_workers;
+    for (int i = 0; i < num_workers; i++) {
+        rt->workers[i].rt = rt;
+        rt->workers[i].release = NULL;
+        pthread_create(&rt->workers[i].tid, NULL, co_worker_main, &rt->workers[i]);
+    }
+}
+
+// Block the calling (non-coroutine) thread until every coroutine has returned
+static inline void co_runtime_wait(co_runtime_t *rt) {
+    pthread_mutex_lock(&rt->lock);
+    while (rt->live > 0)
+        pthread_cond_wait(&rt->all_done, &rt->lock);
+    pthread_mutex_unlock(&rt->lock);
+}
+
+static inline void co_runtime_destroy(co_runtime_t *rt) {
+    co_runtime_wait(rt);
+    pthread_mutex_lock(&rt->lock);
+    rt->stopping = 1;
+    pthread_cond_broadcast(&rt->work);
+    pthread_mutex_unlock(&rt->lock);
+    for (int i = 0; i < rt->num_workers; i++)
+        pthread_join(rt->workers[i].tid, NULL);
+
+    for (int i = 0; i < rt->num_cached; i++)
+        co_stack_unmap(rt->stack_cache[i]);
+    pthread_mutex_destroy(&rt->lock);
+    pthread_cond_destroy(&rt->work);
+    pthread_cond_destroy(&rt->all_done);
+}
+
+// Wait lists (guarded by the owning primitive's guard)
+typedef struct
+{
+    coroutine_t *head;
+    coroutine_t *tail;
+} co_waitq_t;
+
+static inline void co_waitq_push(co_waitq_t *q, coroutine_t *co) {
+    co->next = NULL;
+    if (q->tail != NULL)
+        q->tail->next = co;
+    else
+        q->head = co;
+    q->tail = co;
+}
+
+static inline coroutine_t *co_waitq_pop(co_waitq_t *q) {
+    coroutine_t *co = q->head;
+    if (co != NULL) {
+        q->head = co->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+    }
+    return co;
+}
+
+// Mutex: a blocked coroutine parks instead of blocking its worker.
+// Unlock hands the lock straight to the first waiter (FIFO, no barging).
+typedef struct
+{
+    pthread_mutex_t guard;
+    int locked;
+    co_waitq_t waiters;
+} co_mutex_t;
+
+static inline void co_mutex_init(co_mutex_t *m) {
+    pthread_mutex_init(&m->guard, NULL);
+    m->locked = 0;
+    m->waiters.head = m->waiters.tail = NULL;
+}
+
+static inline void co_mutex_lock(co_mutex_t *m) {
+    pthread_mutex_lock(&m->guard);
+    if (!m->locked) {
+        m->locked = 1;
+        pthread_mutex_unlock(&m->guard);
+        return;
+    }
+    co_waitq_push(&m->waiters, co_current);
+    co_park(&m->guard);
+    // Woken by co_mutex_unlock, which left locked set for us
+}
+
+static inline void co_mutex_unlock(co_mutex_t *m) {
+    pthread_mutex_lock(&m->guard);
+    coroutine_t *next = co_waitq_pop(&m->waiters);
+    if (next != NULL)
+        co_ready(next->rt, next);
+    else
+        m->locked = 0;
+    pthread_mutex_unlock(&m->guard);
+}
+
+static inline void co_mutex_destroy(co_mutex_t *m) {
+    pthread_mutex_destroy(&m->guard);
+}
+
+// Channel: bounded FIFO of void * between coroutines (capacity >= 1)
+typedef struct
+{
+    pthread_mutex_t guard;
+    void **buf;
+    int cap;
+    int head;
+    int count;
+    int closed;
+    co_waitq_t senders;
+    co_waitq_t receivers;
+} co_chan_t;
+
+static inline void co_chan_init(co_chan_t *ch, int cap) {
+    assert(cap >= 1);
+    pthread_mutex_init(&ch->guard, NULL);
+    ch->buf = malloc(cap * sizeof(void *));
+    ch->cap = cap;
+    ch->head = ch->count = ch->closed = 0;
+    ch->senders.head = ch->senders.tail = NULL;
+    ch->receivers.head = ch->receivers.tail = NULL;
+}
+
+// Returns 0 on success, -1 if the channel is closed
+static inline int co_chan_send(co_chan_t *ch, void *v) {
+    pthread_mutex_lock(&ch->guard);
+    while (ch->count == ch->cap && !ch->closed) {
+        co_waitq_push(&ch->senders, co_current);
+        co_park(&ch->guard);
+        pthread_mutex_lock(&ch->guard);
+    }
+    if (ch->closed) {
+        pthread_mutex_unlock(&ch->guard);
+        return -1;
+    }
+    ch->buf[(ch->head + ch->count) % ch->cap] = v;
+    ch->count++;
+    coroutine_t *r = co_waitq_pop(&ch->receivers);
+    if (r != NULL)
+        co_ready(r->rt, r);
+    pthread_mutex_unlock(&ch->guard);
+    return 0;
+}
+
+// Returns 1 with *v set, or 0 once the channel is closed and drained
+static inline int co_chan_recv(co_chan_t *ch, void **v) {
+    pthread_mutex_lock(&ch->guard);
+    while (ch->count == 0 && !ch->closed) {
+        co_waitq_push(&ch->receivers, co_current);
+        co_park(&ch->guard);
+        pthread_mutex_lock(&ch->guard);
+    }
+    if (ch->count == 0) {
+        pthread_mutex_unlock(&ch->guard);
+        return 0;
+    }
+    *v = ch->buf[ch->head];
+    ch->head = (ch->head + 1) % ch->cap;
+    ch->count--;
+    coroutine_t *s = co_waitq_pop(&ch->senders);
+    if (s != NULL)
+        co_ready(s->rt, s);
+    pthread_mutex_unlock(&ch->guard);
+    return 1;
+}
+
+// Wake everyone; later sends fail, receives drain what is left
+static inline void co_chan_close(co_chan_t *ch) {
+    coroutine_t *co;
+    pthread_mutex_lock(&ch->guard);
+    ch->closed = 1;
+    while ((co = co_waitq_pop(&ch->senders)) != NULL)
+        co_ready(co->rt, co);
+    while ((co = co_waitq_pop(&ch->receivers)) != NULL)
+        co_ready(co->rt, co);
+    pthread_mutex_unlock(&ch->guard);
+}
+
+static inline void co_chan_destroy(co_chan_t *ch) {
+    pthread_mutex_destroy(&ch->guard);
+    free(ch->buf);
+}
+
+#endif // __coroutine_h__
@@ -0,0 +1,137 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * parallel_for / parallel_reduce on the work-stealing pool
+ * The counting demos spawn threads by hand and have them all update one shared
+ * variable: either a race (thread.c) or a cache line bouncing between cores on
+ * every increment. Here the range [lo, hi) is cut into chunks of grain indices.
+ * One task per pool worker claims chunks from an atomic cursor until the range
+ * runs out. Each task folds its chunks into its own padded slot, and the slots
+ * are combined once at the end, so the shared cursor is touched once per chunk
+ * rather than once per element.
+ *
+ *     long sum = parallel_reduce(&pool, 0, n, 0, 0, sum_range, add, data);
+ *
+ * grain 0 picks a size that gives each worker about PARALLEL_CHUNKS_PER_WORKER
+ * chunks, rounded up to PARALLEL_GRAIN_ALIGN indices. With elements of 8 bytes or
+ * less, chunk edges then fall on cache-line boundaries and two workers never
+ * write the same line.
+ */
+
+#ifndef __parallel_h__
+#define __parallel_h__
+
+#include <stdatomic.h>
+#include "thread_pool.h"
+
+#define PARALLEL_CACHE_LINE 64
+#define PARALLEL_GRAIN_ALIGN 64          // Indices; a whole line at >= 1 byte per element
+#define PARALLEL_CHUNKS_PER_WORKER 8     // Enough slack to even out slow workers
+
+typedef void (*parallel_for_fn_t)(long lo, long hi, void *arg);
+typedef long (*parallel_map_fn_t)(long lo, long hi, void *arg);
+typedef long (*parallel_combine_fn_t)(long a, long b);
+
+struct parallel;
+
+// Per-task partial result, one cache line each
+typedef struct
+{
+    _Alignas(PARALLEL_CACHE_LINE) long value;
+    long chunks;                 // Chunks this task ran
+    struct parallel *p;
+} parallel_slot_t;
+
+typedef struct parallel
+{
+    _Alignas(PARALLEL_CACHE_LINE) atomic_long next;    // Next unclaimed index
+    long hi, grain;
+    long identity;
+    parallel_map_fn_t map;           // NULL for parallel_for
+    parallel_combine_fn_t combine;
+    parallel_for_fn_t fn;
+    void *arg;
+    int num_tasks;
+    parallel_slot_t slots[POOL_MAX_WORKERS];
+    future_t futures[POOL_MAX_WORKERS];
+} parallel_t;
+
+// Grain for n indices over num_workers workers
+static inline long parallel_grain(long n, int num_workers) {
+    long g = n / ((long)num_workers * PARALLEL_CHUNKS_PER_WORKER);
+    g = (g + PARALLEL_GRAIN_ALIGN - 1) / PARALLEL_GRAIN_ALIGN * PARALLEL_GRAIN_ALIGN;
+    return g > 0 ? g : PARALLEL_GRAIN_ALIGN;
+}
+
+// One task: claim chunks until none are left, fold them into this task's slot
+static inline void *parallel_task(void *arg) {
+    parallel_slot_t *slot = (parallel_slot_t *)arg;
+    parallel_t *p = slot->p;
+    long acc = p->identity, chunks = 0;
+
+    for (;;) {
+        long lo = atomic_fetch_add_explicit(&p->next, p->grain, memory_order_relaxed);
+        if (lo >= p->hi)
+            break;
+        long hi = lo + p->grain < p->hi ? lo + p->grain : p->hi;
+        if (p->map != NULL)
+            acc = p->combine(acc, p->map(lo, hi, p->arg));
+        else
+            p->fn(lo, hi, p->arg);
+        chunks++;
+    }
+    slot->value = acc;
+    slot->chunks = chunks;
+    return NULL;
+}
+
+// Run one task per worker (fewer if there are fewer chunks) and wait for all of them.
+// The caller helps through future_get, so this also works from inside a pool task.
+static inline void parallel_run(thread_pool_t *pool, parallel_t *p, long lo, long hi, long grain) {
+    long n = hi > lo ? hi - lo : 0;
+    p->grain = grain > 0 ? grain : parallel_grain(n, pool->num_workers);
+    p->hi = hi;
+    atomic_init(&p->next, lo);
+
+    long num_chunks = (n + p->grain - 1) / p->grain;
+    p->num_tasks = num_chunks < pool->num_workers ? (int)num_chunks : pool->num_workers;
+    for (int i = 0; i < p->num_tasks; i++) {
+        p->slots[i].p = p;
+        pool_submit(pool, &p->futures[i], parallel_task, &p->slots[i]);
+    }
+    for (int i = 0; i < p->num_tasks; i++)
+        future_get(pool, &p->futures[i]);
+}
+
+// fn(chunk_lo, chunk_hi, arg) over [lo, hi); chunks run in no particular order
+static inline void parallel_for(thread_pool_t *pool, long lo, long hi, long grain,
+                                parallel_for_fn_t fn, void *arg) {
+    parallel_t p = { .fn = fn, .arg = arg };
+    parallel_run(pool, &p, lo, hi, grain);
+}
+
+// combine(identity, map(chunk) for every chunk of [lo, hi)). combine must be
+// associative and commutative: chunks are folded in whatever order tasks claim them.
+// chunks_out, if not NULL, gets the chunk count of each task (pool->num_workers entries).
+static inline long parallel_reduce_stats(thread_pool_t *pool, long lo, long hi, long grain, long identity,
+                                         parallel_map_fn_t map, parallel_combine_fn_t combine, void *arg,
+                                         long *chunks_out) {
+    parallel_t p = { .identity = identity, .map = map, .combine = combine, .arg = arg };
+    parallel_run(pool, &p, lo, hi, grain);
+
+    long result = identity;
+    for (int i = 0; i < pool->num_workers; i++) {
+        if (i < p.num_tasks)
+            result = combine(result, p.slots[i].value);
+        if (chunks_out != NULL)
+            chunks_out[i] = i < p.num_tasks ? p.slots[i].chunks : 0;
+    }
+    return result;
+}
+
+static inline long parallel_reduce(thread_pool_t *pool, long lo, long hi, long grain, long identity,
+                                   parallel_map_fn_t map, parallel_combine_fn_t combine, void *arg) {
+    return parallel_reduce_stats(pool, lo, hi, grain, identity, map, combine, arg, NULL);
+}
+
+#endif // __parallel_h__
@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
+#include "parallel.h"
 
 // Thread creation and joining
 typedef struct  
@@ -94,6 +95,21 @@ void* increment(void* arg) {
     return NULL;
 }
 
+// Fix: don't share the counter. Each worker counts its chunks privately,
+// and the partial counts are added once at the end (parallel.h)
+long count_range(long lo, long hi, void *arg) {
+    (void)arg;
+    long local = 0;
+    for (long i = lo; i < hi; i++) {
+        local++; // Private to this worker, no race
+    }
+    return local;
+}
+
+long add(long a, long b) {
+    return a + b;
+}
+
 int main() {
     pthread_t t1, t2;
 
@@ -103,5 +119,11 @@ int main() {
     pthread_join(t2, NULL);
 
     printf("Counter: %d (Exp:2000000)\n", counter);
+
+    thread_pool_t pool;
+    pool_init(&pool, 2);
+    long total = parallel_reduce(&pool, 0, 2000000, 0, 0, count_range, add, NULL);
+    pool_destroy(&pool);
+    printf("parallel_reduce: %ld (Exp:2000000)\n", total);
     return 0;
 }
@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
+#include <time.h>
+#include "../concurrency/timing.h"
 
 int shared_counter = 0;
 pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
@@ -62,54 +64,187 @@ void* signaler(void* arg) {
     return NULL;
 }
 
-// Pattern-consumer pattern
-#define BUFFER_SIZE 10
+// Producer-consumer pattern
+// FIFO ring for any number of producers and consumers. Condition variables are
+// signalled only when the buffer goes empty -> non-empty or full -> non-full, and
+// only if some waiter hasn't been signalled yet; a woken thread that leaves work
+// behind passes the wakeup on. Batched put/get move many items per lock round trip.
+#define BUFFER_SIZE 256
+#define ITEMS_PER_PRODUCER 1000000
 
 typedef struct 
 {
     int buffer[BUFFER_SIZE];
+    int head;                   // Next slot to read
     int count;
+    int closed;                 // No more puts; gets drain what's left, then return 0
+    int waiting_producers;      // Asleep in (or on the way into) cond_wait
+    int waiting_consumers;
+    int woken_producers;        // Of those, already signalled but not yet running
+    int woken_consumers;
+    long wakeups;               // cond signals sent, for the demo
     pthread_mutex_t lock;
     pthread_cond_t not_empty;
     pthread_cond_t not_full;
 } buffer_t;
 
 buffer_t buf = {
+    .head = 0,
     .count = 0,
+    .closed = 0,
     .lock = PTHREAD_MUTEX_INITIALIZER,
     .not_empty = PTHREAD_COND_INITIALIZER,
     .not_full = PTHREAD_COND_INITIALIZER
 };
 
-void* producer(void* arg) {
-    for (int i = 0; i < 100; i++) {
-        pthread_mutex_lock(&buf.lock);
+// Wake one thread waiting on cond unless every waiter is already on its way
+static void buffer_wake(buffer_t *b, pthread_cond_t *cond, int waiting, int *woken) {
+    if (waiting > *woken) {
+        (*woken)++;
+        pthread_cond_signal(cond);
+        b->wakeups++;
+    }
+}
 
-        while (buf.count == BUFFER_SIZE) { // buffer full
-            pthread_cond_wait(&buf.not_full, &buf.lock);
+// Put all n items, blocking while the buffer is full
+void buffer_put_batch(buffer_t *b, const int *items, int n) {
+    pthread_mutex_lock(&b->lock);
+    while (n > 0) {
+        while (b->count == BUFFER_SIZE) {
+            b->waiting_producers++;
+            pthread_cond_wait(&b->not_full, &b->lock);
+            b->waiting_producers--;
+            if (b->woken_producers > 0)
+                b->woken_producers--;
         }
 
-        buf.buffer[buf.count++] = i;
-        pthread_cond_signal(&buf.not_empty);
-        pthread_mutex_unlock(&buf.lock);
+        int was_empty = b->count == 0;
+        int space = BUFFER_SIZE - b->count;
+        int k = n < space ? n : space;
+        int tail = (b->head + b->count) % BUFFER_SIZE;
+        for (int i = 0; i < k; i++)
+            b->buffer[(tail + i) % BUFFER_SIZE] = items[i];
+        b->count += k;
+        items += k;
+        n -= k;
+
+        if (was_empty)
+            buffer_wake(b, &b->not_empty, b->waiting_consumers, &b->woken_consumers);
+    }
+    // Room left and another producer asleep: pass the full -> non-full wakeup on
+    if (b->count < BUFFER_SIZE)
+        buffer_wake(b, &b->not_full, b->waiting_producers, &b->woken_producers);
+    pthread_mutex_unlock(&b->lock);
+}
+
+// Take up to max items (at least one unless closed and empty); returns how many
+int buffer_get_batch(buffer_t *b, int *items, int max) {
+    pthread_mutex_lock(&b->lock);
+    while (b->count == 0 && !b->closed) {
+        b->waiting_consumers++;
+        pthread_cond_wait(&b->not_empty, &b->lock);
+        b->waiting_consumers--;
+        if (b->woken_consumers > 0)
+            b->woken_consumers--;
+    }
+
+    int was_full = b->count == BUFFER_SIZE;
+    int k = b->count < max ? b->count : max;
+    for (int i = 0; i < k; i++)
+        items[i] = b->buffer[(b->head + i) % BUFFER_SIZE];
+    b->head = (b->head + k) % BUFFER_SIZE;
+    b->count -= k;
+
+    if (was_full && k > 0)
+        buffer_wake(b, &b->not_full, b->waiting_producers, &b->woken_producers);
+    if (b->count > 0)
+        buffer_wake(b, &b->not_empty, b->waiting_consumers, &b->woken_consumers);
+    pthread_mutex_unlock(&b->lock);
+    return k;
+}
+
+void buffer_put(buffer_t *b, int item) {
+    buffer_put_batch(b, &item, 1);
+}
+
+// Returns 0 once the buffer is closed and drained
+int buffer_get(buffer_t *b, int *item) {
+    return buffer_get_batch(b, item, 1);
+}
+
+void buffer_close(buffer_t *b) {
+    pthread_mutex_lock(&b->lock);
+    b->closed = 1;
+    b->woken_consumers = b->waiting_consumers;
+    pthread_cond_broadcast(&b->not_empty);
+    pthread_mutex_unlock(&b->lock);
+}
+
+typedef struct
+{
+    int batch;
+    long sum;       // Consumers: sum of what they took
+    long taken;
+} pc_arg_t;
+
+void* producer(void* arg) {
+    pc_arg_t *a = (pc_arg_t *)arg;
+    int items[BUFFER_SIZE];
+    for (int i = 0; i < ITEMS_PER_PRODUCER; i += a->batch) {
+        int n = ITEMS_PER_PRODUCER - i < a->batch ? ITEMS_PER_PRODUCER - i : a->batch;
+        for (int j = 0; j < n; j++)
+            items[j] = i + j;
+        buffer_put_batch(&buf, items, n);
     }
     return NULL;
 }
 
 void* consumer(void* arg) {
-    for (int i = 0; i < 100; i++) {
-        pthread_mutex_lock(&buf.lock);
+    pc_arg_t *a = (pc_arg_t *)arg;
+    int items[BUFFER_SIZE];
+    int n;
+    while ((n = buffer_get_batch(&buf, items, a->batch)) > 0) {
+        for (int i = 0; i < n; i++)
+            a->sum += items[i];
+        a->taken += n;
+    }
+    return NULL;
+}
 
-        while(buf.count == 0) { // buffer empty-> wait
-            pthread_cond_wait(&buf.not_empty, &buf.lock);
-        }
+// nprod producers push ITEMS_PER_PRODUCER each through buf, batch items per call
+void run_producer_consumer(int nprod, int ncons, int batch) {
+    pthread_t prod[nprod], cons[ncons];
+    pc_arg_t pargs[nprod], cargs[ncons];
+    buf.head = buf.count = buf.closed = 0;
+    buf.woken_producers = buf.woken_consumers = 0;
+    buf.wakeups = 0;
 
-        int item = buf.buffer[--buf.count];
-        printf("Consumed: %d\n", item);
-        pthread_cond_signal(&buf.not_full);
-        pthread_mutex_unlock(&buf.lock);
+    double start = timing_now();
+    for (int i = 0; i < ncons; i++) {
+        cargs[i] = (pc_arg_t){ .batch = batch };
+        pthread_create(&cons[i], NULL, consumer, &cargs[i]);
     }
-    return NULL;
+    for (int i = 0; i < nprod; i++) {
+        pargs[i] = (pc_arg_t){ .batch = batch };
+        pthread_create(&prod[i], NULL, producer, &pargs[i]);
+    }
+    for (int i = 0; i < nprod; i++)
+        pthread_join(prod[i], NULL);
+    buffer_close(&buf);
+
+    long sum = 0, taken = 0;
+    for (int i = 0; i < ncons; i++) {
+        pthread_join(cons[i], NULL);
+        sum += cargs[i].sum;
+        taken += cargs[i].taken;
+    }
+    double elapsed = timing_now() - start;
+
+    long expected = (long)nprod * ITEMS_PER_PRODUCER;
+    assert(taken == expected);
+    assert(sum == (long)nprod * ((long)ITEMS_PER_PRODUCER * (ITEMS_PER_PRODUCER - 1) / 2));
+    printf("  %dP/%dC batch %3d: %10.0f items/second, %.4f wakeups per item\n",
+           nprod, ncons, batch, taken / elapsed, (double)buf.wakeups / taken);
 }
 
 int main() {
@@ -127,5 +262,13 @@ int main() {
     pthread_join(t1, NULL);
     pthread_join(t2, NULL);
 
+    // Test the bounded buffer
+    printf("Producer-consumer, %d items per producer, %d slots:\n", ITEMS_PER_PRODUCER, BUFFER_SIZE);
+    int batches[] = { 1, 16, 64 };
+    for (int i = 0; i < 3; i++) {
+        run_producer_consumer(1, 1, batches[i]);
+        run_producer_consumer(4, 4, batches[i]);
+    }
+
     return 0;
 }
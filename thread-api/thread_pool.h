@@ -0,0 +1,401 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Work-stealing thread pool
+ * Each worker owns a Chase-Lev deque: the owner pushes/pops at the bottom,
+ * thieves steal from the top. Idle workers steal from random victims and
+ * park on a condition variable when there is nothing left to steal.
+ *
+ * A future_t is the task itself and lives in the caller's memory (the stack is fine),
+ * so submitting a task never mallocs.
+ */
+
+#ifndef __thread_pool_h__
+#define __thread_pool_h__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sched.h>
+
+#define POOL_MAX_WORKERS 64
+#define DEQUE_INIT_CAP 256    // Must be a power of two
+#define POOL_SPIN_ROUNDS 64   // Steal attempts before an idle thread parks
+
+typedef void *(*task_fn_t)(void *arg);
+
+// Future = task + result slot, owned by the submitter
+typedef struct future
+{
+    task_fn_t fn;
+    void *arg;
+    void *result;
+    atomic_int done;
+    struct future *next;    // Link for the injection queue
+} future_t;
+
+// Circular array behind a deque. Old arrays are kept until pool_destroy,
+// because a thief may still be reading from one after a resize.
+typedef struct deque_array
+{
+    int64_t cap;
+    struct deque_array *prev;
+    _Atomic(future_t *) slots[];
+} deque_array_t;
+
+// Chase-Lev deque (C11 version from Le et al., PPoPP'13)
+typedef struct
+{
+    _Alignas(64) atomic_int_fast64_t top;       // Thieves CAS here
+    _Alignas(64) atomic_int_fast64_t bottom;    // Only the owner writes here
+    _Atomic(deque_array_t *) array;
+} deque_t;
+
+typedef struct thread_pool thread_pool_t;
+
+typedef struct
+{
+    deque_t deque;
+    thread_pool_t *pool;
+    pthread_t tid;
+    int id;
+    uint64_t rng;    // xorshift state for picking victims
+} worker_t;
+
+struct thread_pool
+{
+    worker_t workers[POOL_MAX_WORKERS];
+    int num_workers;
+
+    // Tasks submitted from threads outside the pool
+    pthread_mutex_t inject_lock;
+    future_t *inject_head;
+    future_t *inject_tail;
+    atomic_int inject_count;
+
+    // Parking for idle workers
+    pthread_mutex_t park_lock;
+    pthread_cond_t park_cond;
+    atomic_uint epoch;      // Bumped on every submit
+    atomic_int sleepers;
+
+    // Parking for threads blocked in future_get
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+    atomic_int waiters;
+
+    atomic_int shutdown;
+};
+
+// Worker running on this thread (NULL outside any pool)
+static __thread worker_t *pool_self = NULL;
+
+static inline deque_array_t *deque_array_new(int64_t cap, deque_array_t *prev) {
+    deque_array_t *a = malloc(sizeof(deque_array_t) + cap * sizeof(_Atomic(future_t *)));
+    assert(a != NULL);
+    a->cap = cap;
+    a->prev = prev;
+    return a;
+}
+
+static inline void deque_init(deque_t *q) {
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->array, deque_array_new(DEQUE_INIT_CAP, NULL));
+}
+
+static inline void deque_destroy(deque_t *q) {
+    deque_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    while (a != NULL) {
+        deque_array_t *prev = a->prev;
+        free(a);
+        a = prev;
+    }
+}
+
+// Owner only: double the array, copying live entries [t, b)
+static inline deque_array_t *deque_grow(deque_t *q, deque_array_t *a, int64_t t, int64_t b) {
+    deque_array_t *na = deque_array_new(a->cap * 2, a);
+    for (int64_t i = t; i < b; i++) {
+        future_t *x = atomic_load_explicit(&a->slots[i & (a->cap - 1)], memory_order_relaxed);
+        atomic_store_explicit(&na->slots[i & (na->cap - 1)], x, memory_order_relaxed);
+    }
+    atomic_store_explicit(&q->array, na, memory_order_release);
+    return na;
+}
+
+// Owner only
+static inline void deque_push(deque_t *q, future_t *f) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    deque_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+
+    if (b - t > a->cap - 1) {
+        a = deque_grow(q, a, t, b);
+    }
+    atomic_store_explicit(&a->slots[b & (a->cap - 1)], f, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+}
+
+// Owner only, LIFO end
+static inline future_t *deque_pop(deque_t *q) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    deque_array_t *a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+
+    future_t *f = NULL;
+    if (t <= b) {
+        f = atomic_load_explicit(&a->slots[b & (a->cap - 1)], memory_order_relaxed);
+        if (t == b) {
+            // Last item: race against thieves for it
+            if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+                    memory_order_seq_cst, memory_order_relaxed)) {
+                f = NULL;
+            }
+            atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        }
+    } else {
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+    return f;
+}
+
+// Any thread, FIFO end. Returns NULL when empty or when losing a race.
+static inline future_t *deque_steal(deque_t *q) {
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+
+    if (t >= b) {
+        return NULL;
+    }
+    deque_array_t *a = atomic_load_explicit(&q->array, memory_order_acquire);
+    future_t *f = atomic_load_explicit(&a->slots[t & (a->cap - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1,
+            memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return f;
+}
+
+static inline uint64_t pool_rand(uint64_t *s) {
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static inline future_t *pool_inject_pop(thread_pool_t *pool) {
+    if (atomic_load_explicit(&pool->inject_count, memory_order_relaxed) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&pool->inject_lock);
+    future_t *f = pool->inject_head;
+    if (f != NULL) {
+        pool->inject_head = f->next;
+        if (pool->inject_head == NULL) {
+            pool->inject_tail = NULL;
+        }
+        atomic_fetch_sub(&pool->inject_count, 1);
+    }
+    pthread_mutex_unlock(&pool->inject_lock);
+    return f;
+}
+
+// Own deque first, then the injection queue, then random victims
+static inline future_t *pool_find_task(thread_pool_t *pool, worker_t *self, uint64_t *rng) {
+    future_t *f;
+    if (self != NULL && (f = deque_pop(&self->deque)) != NULL) {
+        return f;
+    }
+    if ((f = pool_inject_pop(pool)) != NULL) {
+        return f;
+    }
+    int n = pool->num_workers;
+    int start = (int)(pool_rand(rng) % n);
+    for (int i = 0; i < n; i++) {
+        worker_t *victim = &pool->workers[(start + i) % n];
+        if (victim == self) {
+            continue;
+        }
+        if ((f = deque_steal(&victim->deque)) != NULL) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+static inline void pool_run(thread_pool_t *pool, future_t *f) {
+    f->result = f->fn(f->arg);
+    atomic_store_explicit(&f->done, 1, memory_order_seq_cst);
+
+    // Only pay for the broadcast if someone is actually blocked
+    if (atomic_load(&pool->waiters) > 0) {
+        pthread_mutex_lock(&pool->done_lock);
+        pthread_cond_broadcast(&pool->done_cond);
+        pthread_mutex_unlock(&pool->done_lock);
+    }
+}
+
+static inline void pool_wake(thread_pool_t *pool) {
+    atomic_fetch_add(&pool->epoch, 1);
+    if (atomic_load(&pool->sleepers) > 0) {
+        pthread_mutex_lock(&pool->park_lock);
+        pthread_cond_signal(&pool->park_cond);
+        pthread_mutex_unlock(&pool->park_lock);
+    }
+}
+
+static inline void *pool_worker_main(void *arg) {
+    worker_t *w = (worker_t *)arg;
+    thread_pool_t *pool = w->pool;
+    pool_self = w;
+
+    while (!atomic_load(&pool->shutdown)) {
+        future_t *f = NULL;
+        unsigned epoch = 0;
+
+        // Spin a little before parking: the next task usually shows up quickly
+        for (int i = 0; i < POOL_SPIN_ROUNDS && f == NULL; i++) {
+            epoch = atomic_load(&pool->epoch);
+            f = pool_find_task(pool, w, &w->rng);
+        }
+        if (f != NULL) {
+            pool_run(pool, f);
+            continue;
+        }
+
+        // Park until a submit bumps the epoch we observed before the last search
+        pthread_mutex_lock(&pool->park_lock);
+        atomic_fetch_add(&pool->sleepers, 1);
+        while (atomic_load(&pool->epoch) == epoch && !atomic_load(&pool->shutdown)) {
+            pthread_cond_wait(&pool->park_cond, &pool->park_lock);
+        }
+        atomic_fetch_sub(&pool->sleepers, 1);
+        pthread_mutex_unlock(&pool->park_lock);
+    }
+
+    pool_self = NULL;
+    return NULL;
+}
+
+// Start num_workers workers
+static inline void pool_init(thread_pool_t *pool, int num_workers) {
+    assert(num_workers > 0 && num_workers <= POOL_MAX_WORKERS);
+    pool->num_workers = num_workers;
+
+    pthread_mutex_init(&pool->inject_lock, NULL);
+    pool->inject_head = NULL;
+    pool->inject_tail = NULL;
+    atomic_init(&pool->inject_count, 0);
+
+    pthread_mutex_init(&pool->park_lock, NULL);
+    pthread_cond_init(&pool->park_cond, NULL);
+    atomic_init(&pool->epoch, 0);
+    atomic_init(&pool->sleepers, 0);
+
+    pthread_mutex_init(&pool->done_lock, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    atomic_init(&pool->waiters, 0);
+
+    atomic_init(&pool->shutdown, 0);
+
+    for (int i = 0; i < num_workers; i++) {
+        worker_t *w = &pool->workers[i];
+        deque_init(&w->deque);
+        w->pool = pool;
+        w->id = i;
+        w->rng = 0x9E3779B97F4A7C15ULL * (i + 1);
+    }
+    // Create threads only after every deque exists, since workers steal right away
+    for (int i = 0; i < num_workers; i++) {
+        int rc = pthread_create(&pool->workers[i].tid, NULL, pool_worker_main, &pool->workers[i]);
+        assert(rc == 0);
+    }
+}
+
+// Queue fn(arg) for execution; the result is read back with future_get.
+// f must stay valid until future_get returns.
+static inline void pool_submit(thread_pool_t *pool, future_t *f, task_fn_t fn, void *arg) {
+    f->fn = fn;
+    f->arg = arg;
+    f->result = NULL;
+    f->next = NULL;
+    atomic_store_explicit(&f->done, 0, memory_order_relaxed);
+
+    worker_t *self = pool_self;
+    if (self != NULL && self->pool == pool) {
+        deque_push(&self->deque, f);
+    } else {
+        pthread_mutex_lock(&pool->inject_lock);
+        if (pool->inject_tail == NULL) {
+            pool->inject_head = f;
+        } else {
+            pool->inject_tail->next = f;
+        }
+        pool->inject_tail = f;
+        atomic_fetch_add(&pool->inject_count, 1);
+        pthread_mutex_unlock(&pool->inject_lock);
+    }
+    pool_wake(pool);
+}
+
+// Wait for f and return its result. The caller runs other tasks while it waits,
+// so nested submit/get from inside a task cannot deadlock the pool.
+static inline void *future_get(thread_pool_t *pool, future_t *f) {
+    worker_t *self = (pool_self != NULL && pool_self->pool == pool) ? pool_self : NULL;
+    uint64_t local_rng = (uint64_t)(uintptr_t)f | 1;
+    uint64_t *rng = self != NULL ? &self->rng : &local_rng;
+    int idle = 0;
+
+    while (!atomic_load_explicit(&f->done, memory_order_acquire)) {
+        future_t *other = pool_find_task(pool, self, rng);
+        if (other != NULL) {
+            pool_run(pool, other);
+            idle = 0;
+            continue;
+        }
+        if (++idle < POOL_SPIN_ROUNDS) {
+            sched_yield();
+            continue;
+        }
+
+        // Nothing to help with: f is running elsewhere, block until some task completes
+        pthread_mutex_lock(&pool->done_lock);
+        atomic_fetch_add(&pool->waiters, 1);
+        if (!atomic_load(&f->done)) {
+            pthread_cond_wait(&pool->done_cond, &pool->done_lock);
+        }
+        atomic_fetch_sub(&pool->waiters, 1);
+        pthread_mutex_unlock(&pool->done_lock);
+        idle = 0;
+    }
+    return f->result;
+}
+
+// Stop workers and free deques. Pending tasks are not run.
+static inline void pool_destroy(thread_pool_t *pool) {
+    atomic_store(&pool->shutdown, 1);
+    pthread_mutex_lock(&pool->park_lock);
+    pthread_cond_broadcast(&pool->park_cond);
+    pthread_mutex_unlock(&pool->park_lock);
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        pthread_join(pool->workers[i].tid, NULL);
+        deque_destroy(&pool->workers[i].deque);
+    }
+
+    pthread_mutex_destroy(&pool->inject_lock);
+    pthread_mutex_destroy(&pool->park_lock);
+    pthread_cond_destroy(&pool->park_cond);
+    pthread_mutex_destroy(&pool->done_lock);
+    pthread_cond_destroy(&pool->done_cond);
+}
+
+#endif // __thread_pool_h__
@@ -0,0 +1,126 @@
+/**
+ * OSTEP - Concurrency
+ *
+ * Work-stealing thread pool vs. one pthread per task
+ * Same a+b task as thread.c, but results come back through a future
+ * instead of a malloc'ed thread_ret_t.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "thread_pool.h"
+#include "../concurrency/timing.h"
+
+#define NUM_WORKERS 4
+#define NUM_TASKS 100000
+#define FIB_N 32
+#define FIB_CUTOFF 16    // Below this, recurse serially
+
+thread_pool_t pool;
+
+typedef struct
+{
+    int a;
+    int b;
+} thread_arg_t;
+
+// Task: result fits in the pointer, so nothing is allocated
+void* add_task(void* arg) {
+    thread_arg_t *args = (thread_arg_t *)arg;
+    return (void *)(intptr_t)(args->a + args->b);
+}
+
+// Same task, thread.c style: heap result per thread
+void* add_thread(void* arg) {
+    thread_arg_t *args = (thread_arg_t *)arg;
+    int *ret = malloc(sizeof(int));
+    *ret = args->a + args->b;
+    return ret;
+}
+
+long fib_serial(int n) {
+    return n < 2 ? n : fib_serial(n - 1) + fib_serial(n - 2);
+}
+
+// Fork-join: spawn one half, do the other half ourselves, then join
+void* fib_task(void* arg) {
+    int n = (int)(intptr_t)arg;
+    if (n < FIB_CUTOFF) {
+        return (void *)(intptr_t)fib_serial(n);
+    }
+
+    future_t left;    // Lives on this task's stack until future_get returns
+    pool_submit(&pool, &left, fib_task, (void *)(intptr_t)(n - 1));
+    long right = (long)(intptr_t)fib_task((void *)(intptr_t)(n - 2));
+    return (void *)(intptr_t)((long)(intptr_t)future_get(&pool, &left) + right);
+}
+
+int main() {
+    pool_init(&pool, NUM_WORKERS);
+    printf("Pool started with %d workers\n", NUM_WORKERS);
+
+    // Basic submit/get
+    thread_arg_t args = {10, 20};
+    future_t f;
+    pool_submit(&pool, &f, add_task, &args);
+    printf("Task returned: %d\n\n", (int)(intptr_t)future_get(&pool, &f));
+
+    // Fine-grained tasks: pthread per task
+    thread_arg_t *targs = malloc(NUM_TASKS * sizeof(thread_arg_t));
+    for (int i = 0; i < NUM_TASKS; i++) {
+        targs[i].a = i;
+        targs[i].b = 1;
+    }
+
+    int threaded_tasks = NUM_TASKS / 10;   // Much slower, so run fewer
+    long sum = 0;
+    double start_time = timing_now();
+    for (int i = 0; i < threaded_tasks; i++) {
+        pthread_t tid;
+        int *ret;
+        pthread_create(&tid, NULL, add_thread, &targs[i]);
+        pthread_join(tid, (void **)&ret);
+        sum += *ret;
+        free(ret);
+    }
+    double end_time = timing_now();
+    double thread_ns = (end_time - start_time) * 1e9 / threaded_tasks;
+    printf("pthread per task: %d tasks, sum %ld, %.0f ns/task\n", threaded_tasks, sum, thread_ns);
+
+    // Fine-grained tasks: pool, futures in one array allocated up front
+    future_t *futures = malloc(NUM_TASKS * sizeof(future_t));
+    sum = 0;
+    start_time = timing_now();
+    for (int i = 0; i < NUM_TASKS; i++) {
+        pool_submit(&pool, &futures[i], add_task, &targs[i]);
+    }
+    for (int i = 0; i < NUM_TASKS; i++) {
+        sum += (long)(intptr_t)future_get(&pool, &futures[i]);
+    }
+    end_time = timing_now();
+    double pool_ns = (end_time - start_time) * 1e9 / NUM_TASKS;
+    printf("thread pool:      %d tasks, sum %ld, %.0f ns/task\n", NUM_TASKS, sum, pool_ns);
+    printf("Speedup per task: %.1fx\n\n", thread_ns / pool_ns);
+
+    // Recursive fork-join: most tasks are spawned by workers and stolen
+    start_time = timing_now();
+    long serial = fib_serial(FIB_N);
+    end_time = timing_now();
+    printf("fib(%d) serial: %ld in %.4f seconds\n", FIB_N, serial, end_time - start_time);
+
+    future_t root;
+    start_time = timing_now();
+    pool_submit(&pool, &root, fib_task, (void *)(intptr_t)FIB_N);
+    long parallel = (long)(intptr_t)future_get(&pool, &root);
+    end_time = timing_now();
+    printf("fib(%d) pool:   %ld in %.4f seconds %s\n", FIB_N, parallel, end_time - start_time,
+           parallel == serial ? "(correct)" : "(WRONG)");
+
+    free(futures);
+    free(targs);
+    pool_destroy(&pool);
+
+    return 0;
+}